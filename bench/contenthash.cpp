@@ -0,0 +1,71 @@
+/**
+ * @file        contenthash.cpp
+ * @description Times PNG::contentHash against PNG::computeHash, and against
+ *              ContentHasher alone over the image's RGBA8 bytes.
+ *
+ *              Usage: bench_contenthash [runs] [image.png ...]
+ *              Defaults to 20 runs of the images in data/.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "cs221util/ContentHash.h"
+#include "cs221util/PNG.h"
+
+using namespace std;
+using namespace cs221util;
+
+namespace {
+    // Average time of runs calls of f in milliseconds; results go to sink so they can't be optimized away
+    template <class F>
+    double averageMs(unsigned int runs, uint64_t& sink, F f) {
+        auto start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < runs; i++) sink += f();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / runs;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int runs = argc > 1 ? atoi(argv[1]) : 20;
+    vector<string> files(argv + min(argc, 2), argv + argc);
+    if (files.empty()) files = { "data/kkkk-256x224-resized.png", "data/kkkk_pruned-resized.png" };
+    if (runs == 0) runs = 1;
+
+    uint64_t sink = 0;
+    printf("%-36s %11s %11s %11s %9s\n", "image", "computeHash", "contentHash", "raw bytes", "raw GB/s");
+    for (const string& file : files) {
+        PNG image;
+        if (!image.readFromFile(file)) return 1;
+
+        // The bytes contentHash sees, prepared up front to time the hash alone
+        vector<unsigned char> bytes;
+        bytes.reserve((size_t) image.width() * image.height() * 4);
+        for (const RGBAPixel* row : image.rows()) {
+            for (unsigned int x = 0; x < image.width(); x++) {
+                bytes.push_back(row[x].r);
+                bytes.push_back(row[x].g);
+                bytes.push_back(row[x].b);
+                bytes.push_back(row[x].a * 255);
+            }
+        }
+
+        double slow = averageMs(runs, sink, [&]() { return (uint64_t) image.computeHash(); });
+        double fast = averageMs(runs, sink, [&]() { return image.contentHash(); });
+        double raw = averageMs(runs, sink, [&]() {
+            ContentHasher hasher;
+            hasher.update(bytes.data(), bytes.size());
+            return hasher.digest();
+        });
+
+        string name = file + " " + to_string(image.width()) + "x" + to_string(image.height());
+        printf("%-36s %8.2f ms %8.2f ms %8.2f ms %9.2f\n", name.c_str(), slow, fast, raw,
+               bytes.size() / (raw * 1e6));
+    }
+    printf("(checksum %016llx)\n", (unsigned long long) sink);
+    return 0;
+}
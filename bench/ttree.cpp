@@ -0,0 +1,87 @@
+/**
+ * @file        ttree.cpp
+ * @description Compares the .ttree encodings with PNG files of the rendered
+ *              tree: size in bytes, and the time of Serialize/Deserialize
+ *              in memory against PNG::writeToFile/readFromFile.
+ *
+ *              Usage: bench_ttree [runs] [image.png ...]
+ *              Defaults to 3 runs of the images in data/, each pruned at
+ *              tolerances 0, 0.05 and 0.2.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "tripletree.h"
+
+using namespace std;
+using namespace cs221util;
+
+namespace {
+    // Average time of runs calls of f in milliseconds; results go to sink so they can't be optimized away
+    template <class F>
+    double averageMs(unsigned int runs, uint64_t& sink, F f) {
+        auto start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < runs; i++) sink += f();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / runs;
+    }
+
+    const char* PNG_FILE = "bench_ttree.png";
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int runs = argc > 1 ? atoi(argv[1]) : 3;
+    vector<string> files(argv + min(argc, 2), argv + argc);
+    if (files.empty()) files = { "data/kkkk-256x224-resized.png", "data/kkkk_pruned-resized.png" };
+    if (runs == 0) runs = 1;
+
+    const TripleTree::TreeEncoding encodings[] = { TripleTree::TTREE_DEFLATE, TripleTree::TTREE_RANGE_CODED,
+                                                   TripleTree::TTREE_PROGRESSIVE, TripleTree::TTREE_TILED };
+    const char* names[] = { "TTREE_DEFLATE", "TTREE_RANGE_CODED", "TTREE_PROGRESSIVE", "TTREE_TILED" };
+
+    uint64_t sink = 0;
+    printf("%-40s %5s %8s  %-18s %9s %9s %9s\n", "image", "tol", "leaves", "format", "bytes", "write ms", "read ms");
+    for (const string& file : files) {
+        PNG image;
+        if (!image.readFromFile(file)) return 1;
+        string name = file + " " + to_string(image.width()) + "x" + to_string(image.height());
+
+        for (double tol : { 0.0, 0.05, 0.2 }) {
+            TripleTree tree(image);
+            tree.Prune(tol);
+
+            PNG rendered = tree.Render();
+            double write = averageMs(runs, sink, [&]() { return (uint64_t) rendered.writeToFile(PNG_FILE); });
+            double read = averageMs(runs, sink, [&]() {
+                PNG decoded;
+                return (uint64_t) decoded.readFromFile(PNG_FILE);
+            });
+            FILE* png = fopen(PNG_FILE, "rb");
+            long pngBytes = -1;
+            if (png && fseek(png, 0, SEEK_END) == 0) pngBytes = ftell(png);
+            if (png) fclose(png);
+            printf("%-40s %5.2f %8d  %-18s %9ld %9.2f %9.2f\n", name.c_str(), tol, tree.NumLeaves(), "PNG file",
+                   pngBytes, write, read);
+
+            for (unsigned int e = 0; e < 4; e++) {
+                vector<unsigned char> bytes;
+                double encode = averageMs(runs, sink, [&]() {
+                    bytes.clear();
+                    return (uint64_t) tree.Serialize(bytes, encodings[e]);
+                });
+                double decode = averageMs(runs, sink, [&]() {
+                    TripleTree decoded;
+                    return (uint64_t) decoded.Deserialize(bytes.data(), bytes.size());
+                });
+                printf("%-40s %5s %8s  %-18s %9zu %9.2f %9.2f\n", "", "", "", names[e], bytes.size(), encode, decode);
+            }
+        }
+    }
+    remove(PNG_FILE);
+    printf("(checksum %016llx)\n", (unsigned long long) sink);
+    return 0;
+}
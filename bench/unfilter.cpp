@@ -0,0 +1,130 @@
+/**
+ * @file        unfilter.cpp
+ * @description Checks LodePNG's unfilterScanline, with its SSE2 kernels,
+ *              against the scalar loops it had before them, then times
+ *              each filter type on an RGBA row, where unfilterScanline
+ *              runs unfilterSub4SSE2, unfilterUpSSE2, unfilterAverage4SSE2
+ *              and unfilterPaeth4SSE2.
+ *
+ *              Usage: bench_unfilter [scanlines] [pixels per row]
+ *              Defaults to 20000 random scanlines for the check, and to
+ *              timing 20000 rows of 4000 pixels. Exits with 1 if any
+ *              scanline differs.
+ *
+ *              LodePNG is compiled in here, so its static functions can be
+ *              called directly.
+ */
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "cs221util/lodepng/lodepng.cpp"
+
+using namespace std;
+
+namespace {
+    // unfilterScanline as upstream LodePNG has it, one byte at a time
+    void scalarUnfilter(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                        size_t bytewidth, unsigned char filterType, size_t length) {
+        size_t i;
+        switch (filterType) {
+            case 0:
+                for (i = 0; i != length; ++i) recon[i] = scanline[i];
+                break;
+            case 1:
+                for (i = 0; i != bytewidth; ++i) recon[i] = scanline[i];
+                for (i = bytewidth; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
+                break;
+            case 2:
+                for (i = 0; i != length; ++i) recon[i] = scanline[i] + (precon ? precon[i] : 0);
+                break;
+            case 3:
+                for (i = 0; i != bytewidth; ++i) recon[i] = scanline[i] + (precon ? precon[i] >> 1 : 0);
+                for (i = bytewidth; i < length; ++i)
+                    recon[i] = scanline[i] + ((recon[i - bytewidth] + (precon ? precon[i] : 0)) >> 1);
+                break;
+            case 4:
+                for (i = 0; i != bytewidth; ++i) recon[i] = scanline[i] + (precon ? precon[i] : 0);
+                for (i = bytewidth; i < length; ++i) {
+                    recon[i] = scanline[i] + (precon ? paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth])
+                                                     : recon[i - bytewidth]);
+                }
+                break;
+        }
+    }
+
+    // Average time of runs calls of f in milliseconds
+    template <class F>
+    double averageMs(unsigned int runs, F f) {
+        auto start = chrono::steady_clock::now();
+        for (unsigned int i = 0; i < runs; i++) f();
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / runs;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    unsigned int scanlines = argc > 1 ? atoi(argv[1]) : 20000;
+    size_t pixels = argc > 2 ? atoi(argv[2]) : 4000;
+    if (pixels == 0) pixels = 1;
+
+    // Random scanlines of every filter type and pixel size 1 to 8, with and
+    // without a previous row, written in place and to separate memory
+    mt19937 random(221);
+    size_t mismatches = 0;
+    for (unsigned int n = 0; n < scanlines; n++) {
+        size_t bytewidth = 1 + random() % 8;
+        size_t length = bytewidth * (1 + random() % 300);
+        unsigned char filterType = random() % 5;
+        bool firstRow = random() % 4 == 0;
+        bool inPlace = random() % 2 == 0;
+
+        vector<unsigned char> scanline(length), precon(length), expected(length), actual(length);
+        for (size_t i = 0; i < length; i++) {
+            scanline[i] = random();
+            precon[i] = random();
+        }
+        const unsigned char* prev = firstRow ? NULL : precon.data();
+        scalarUnfilter(expected.data(), scanline.data(), prev, bytewidth, filterType, length);
+        if (inPlace) {
+            actual = scanline;
+            unfilterScanline(actual.data(), actual.data(), prev, bytewidth, filterType, length);
+        } else {
+            unfilterScanline(actual.data(), scanline.data(), prev, bytewidth, filterType, length);
+        }
+        if (actual != expected) mismatches++;
+    }
+    printf("unfilterScanline matches the scalar loops on %u random scanlines: %s\n", scanlines,
+           mismatches ? "no" : "yes");
+    if (mismatches) return 1;
+
+    // Throughput on one RGBA row in cache, unfiltered repeatedly
+    size_t length = pixels * 4;
+    vector<unsigned char> scanline(length), precon(length), recon(length);
+    for (size_t i = 0; i < length; i++) {
+        scanline[i] = random();
+        precon[i] = random();
+    }
+    const char* names[] = { "None", "Sub (unfilterSub4SSE2)", "Up (unfilterUpSSE2)",
+                            "Average (unfilterAverage4SSE2)", "Paeth (unfilterPaeth4SSE2)" };
+    unsigned int rows = 20000;
+    unsigned int checksum = 0;
+    printf("%u rows of %zu RGBA pixels, GB/s:\n", rows, pixels);
+    printf("%-32s %9s %9s\n", "filter", "scalar", "lodepng");
+    for (unsigned char filterType = 0; filterType < 5; filterType++) {
+        double scalar = averageMs(rows, [&]() {
+            scalarUnfilter(recon.data(), scanline.data(), precon.data(), 4, filterType, length);
+            checksum += recon[length - 1];
+        });
+        double fast = averageMs(rows, [&]() {
+            unfilterScanline(recon.data(), scanline.data(), precon.data(), 4, filterType, length);
+            checksum += recon[length - 1];
+        });
+        printf("%-32s %9.2f %9.2f\n", names[filterType], length / (scalar * 1e6), length / (fast * 1e6));
+    }
+    printf("(checksum %08x)\n", checksum);
+    return 0;
+}
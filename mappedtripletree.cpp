@@ -0,0 +1,304 @@
+/**
+ * @file        mappedtripletree.cpp
+ * @description Flat, memory-mappable TripleTree files.
+ */
+
+#include "mappedtripletree.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+namespace {
+    const char FLAT_MAGIC[4] = { 'T', 'T', 'F', 'L' };
+    const uint32_t FLAT_VERSION = 1;
+    // Reads back as this value only on machines with the writer's byte order
+    const uint32_t FLAT_BYTE_ORDER = 0x01020304;
+}
+
+/*
+ * Start of every file. Field sizes are fixed and the struct has no padding,
+ * so it is the same on every compiler for a given byte order.
+ */
+struct MappedTripleTree::FileHeader {
+    char magic[4];         // "TTFL"
+    uint32_t byteOrder;    // FLAT_BYTE_ORDER, in the writer's byte order
+    uint32_t version;
+    uint32_t nodeSize;     // sizeof(FlatNode)
+    uint32_t width;        // image dimensions
+    uint32_t height;
+    uint64_t nodeCount;    // number of nodes following the header
+    uint64_t leafCount;
+};
+
+/*
+ * One node. A node's subtree occupies the nodes from it up to its next
+ * sibling, so children are found by offsets from their parent: A always
+ * comes right after it.
+ */
+struct MappedTripleTree::FlatNode {
+    uint32_t x;            // upper left corner
+    uint32_t y;
+    uint32_t width;        // dimensions
+    uint32_t height;
+    uint32_t childB;       // distance to B in nodes, or 0 if there is none
+    uint32_t childC;       // distance to C in nodes, or 0 for leaves
+    uint8_t r;             // average color
+    uint8_t g;
+    uint8_t b;
+    uint8_t reserved[5];
+    double a;
+    double spread;         // largest distance of a leaf from the average
+};
+
+MappedTripleTree::MappedTripleTree()
+    : nodes(nullptr), nodeCount(0), width(0), height(0), leafCount(0) {
+}
+
+/*
+ * Appends the node and its subtree in preorder, and the colors of its
+ * leaves to leaves, from which internal nodes take their spread.
+ */
+bool MappedTripleTree::flattenNode(const Node* node, vector<FlatNode>& nodes, vector<RGBAPixel>& leaves) {
+    size_t index = nodes.size();
+    size_t firstLeaf = leaves.size();
+    nodes.push_back(FlatNode());
+
+    FlatNode flat;
+    memset(&flat, 0, sizeof(flat));
+    flat.x = node->upperleft.first;
+    flat.y = node->upperleft.second;
+    flat.width = node->width;
+    flat.height = node->height;
+    flat.r = node->avg.r;
+    flat.g = node->avg.g;
+    flat.b = node->avg.b;
+    flat.a = node->avg.a;
+
+    if (!node->A && !node->B && !node->C) {
+        leaves.push_back(node->avg);
+    } else {
+        if (!node->A || !node->C || !flattenNode(node->A, nodes, leaves)) return false;
+        if (node->B) {
+            flat.childB = nodes.size() - index;
+            if (!flattenNode(node->B, nodes, leaves)) return false;
+        }
+        if (nodes.size() - index > numeric_limits<uint32_t>::max()) return false;
+        flat.childC = nodes.size() - index;
+        if (!flattenNode(node->C, nodes, leaves)) return false;
+        flat.spread = maxDistanceTo(node->avg, &leaves[firstLeaf], leaves.size() - firstLeaf);
+    }
+
+    nodes[index] = flat;
+    return true;
+}
+
+bool MappedTripleTree::Write(const TripleTree& tree, vector<unsigned char>& out) {
+    vector<FlatNode> flat;
+    vector<RGBAPixel> leaves;
+    if (tree.root && !flattenNode(tree.root, flat, leaves)) return false;
+
+    FileHeader header;
+    memcpy(header.magic, FLAT_MAGIC, sizeof(FLAT_MAGIC));
+    header.byteOrder = FLAT_BYTE_ORDER;
+    header.version = FLAT_VERSION;
+    header.nodeSize = sizeof(FlatNode);
+    header.width = tree.root ? tree.root->width : 0;
+    header.height = tree.root ? tree.root->height : 0;
+    header.nodeCount = flat.size();
+    header.leafCount = leaves.size();
+
+    out.resize(sizeof(header) + flat.size() * sizeof(FlatNode));
+    memcpy(&out[0], &header, sizeof(header));
+    if (!flat.empty()) memcpy(&out[sizeof(header)], flat.data(), flat.size() * sizeof(FlatNode));
+    return true;
+}
+
+bool MappedTripleTree::Write(const TripleTree& tree, const string& fileName) {
+    vector<unsigned char> bytes;
+    if (!Write(tree, bytes)) {
+        cerr << "MappedTripleTree: " << fileName << ": tree has an internal node without A or C" << endl;
+        return false;
+    }
+
+    ofstream file(fileName.c_str(), ios::out | ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (!file) {
+        cerr << "MappedTripleTree: failed to write " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Checks the header and the root and takes the nodes in place. The other
+ * nodes are not checked here, which would take time proportional to the
+ * tree; queries check the offsets they follow instead.
+ */
+bool MappedTripleTree::attach(const unsigned char* data, size_t size) {
+    static_assert(sizeof(FileHeader) == 40 && sizeof(FlatNode) == 48, "the layout must have no padding");
+    static_assert(numeric_limits<double>::is_iec559, "doubles are stored as IEEE 754");
+
+    FileHeader header;
+    if (size < sizeof(header) || reinterpret_cast<uintptr_t>(data) % alignof(FlatNode) != 0) return false;
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, FLAT_MAGIC, sizeof(FLAT_MAGIC)) != 0 || header.byteOrder != FLAT_BYTE_ORDER ||
+        header.version != FLAT_VERSION || header.nodeSize != sizeof(FlatNode) ||
+        (size - sizeof(header)) % sizeof(FlatNode) != 0 ||
+        (size - sizeof(header)) / sizeof(FlatNode) != header.nodeCount ||
+        (header.nodeCount == 0) != (header.width == 0 || header.height == 0)) {
+        return false;
+    }
+
+    // The root must cover the image the header describes
+    const FlatNode* flat = reinterpret_cast<const FlatNode*>(data + sizeof(header));
+    if (header.nodeCount > 0 && (flat[0].x != 0 || flat[0].y != 0 ||
+                                 flat[0].width != header.width || flat[0].height != header.height)) {
+        return false;
+    }
+
+    nodes = flat;
+    nodeCount = header.nodeCount;
+    width = header.width;
+    height = header.height;
+    leafCount = header.leafCount;
+    return true;
+}
+
+bool MappedTripleTree::Open(const unsigned char* data, size_t size) {
+    Close();
+    return attach(data, size);
+}
+
+bool MappedTripleTree::Open(const string& fileName) {
+    Close();
+    // Queries jump around the node array, so don't ask for read-ahead
+    if (!file.open(fileName, false)) {
+        cerr << "MappedTripleTree: failed to open " << fileName << endl;
+        return false;
+    }
+    if (!attach(file.data(), file.size())) {
+        cerr << "MappedTripleTree: " << fileName << " is not a .ttflat file this machine can read" << endl;
+        Close();
+        return false;
+    }
+    return true;
+}
+
+void MappedTripleTree::Close() {
+    file.close();
+    nodes = nullptr;
+    nodeCount = 0;
+    width = 0;
+    height = 0;
+    leafCount = 0;
+}
+
+unsigned int MappedTripleTree::Width() const {
+    return width;
+}
+
+unsigned int MappedTripleTree::Height() const {
+    return height;
+}
+
+int MappedTripleTree::NumLeaves() const {
+    return leafCount;
+}
+
+RGBAPixel MappedTripleTree::colorOf(const FlatNode& node) {
+    return RGBAPixel(node.r, node.g, node.b, node.a);
+}
+
+/*
+ * Calls visit on every leaf of the tree pruned at tol, in preorder. Each
+ * child must lie within its parent's range of the array, before the next
+ * sibling, so a corrupt file can make the walk skip nodes but never read
+ * outside the array or visit a node twice.
+ */
+template <class Visit>
+void MappedTripleTree::visitLeaves(double tol, Visit visit) const {
+    if (nodeCount == 0) return;
+
+    struct Range {
+        uint64_t index;
+        uint64_t end;       // first node after the subtree
+    };
+    vector<Range> stack(1, Range{ 0, nodeCount });
+
+    while (!stack.empty()) {
+        Range range = stack.back();
+        stack.pop_back();
+        const FlatNode& node = nodes[range.index];
+        if (node.childC == 0 || node.spread <= tol) {
+            visit(node);
+            continue;
+        }
+
+        uint64_t size = range.end - range.index;
+        uint64_t b = node.childB, c = node.childC;
+        if (c >= size || (b != 0 && (b <= 1 || b >= c))) continue;
+        stack.push_back(Range{ range.index + c, range.end });
+        if (b != 0) stack.push_back(Range{ range.index + b, range.index + c });
+        stack.push_back(Range{ range.index + 1, range.index + (b != 0 ? b : c) });
+    }
+}
+
+int MappedTripleTree::NumLeaves(double tol) const {
+    int count = 0;
+    visitLeaves(tol, [&count](const FlatNode&) { count++; });
+    return count;
+}
+
+PNG MappedTripleTree::Render() const {
+    return Render(-1);
+}
+
+PNG MappedTripleTree::Render(double tol) const {
+    if (nodeCount == 0) return PNG();
+
+    PNG image(width, height);
+    visitLeaves(tol, [&](const FlatNode& node) {
+        if (node.x >= width || node.y >= height) return;
+        unsigned int w = min(node.width, width - node.x);
+        unsigned int h = min(node.height, height - node.y);
+        RGBAPixel color = colorOf(node);
+        for (unsigned int y = node.y; y < node.y + h; y++) {
+            RGBAPixel* row = image.row(y) + node.x;
+            fill(row, row + w, color);
+        }
+    });
+    return image;
+}
+
+RGBAPixel MappedTripleTree::ColorAt(unsigned int x, unsigned int y, double tol) const {
+    auto contains = [x, y](const FlatNode& node) {
+        return x >= node.x && y >= node.y && x - node.x < node.width && y - node.y < node.height;
+    };
+
+    if (nodeCount == 0 || !contains(nodes[0])) return RGBAPixel();
+    uint64_t index = 0, end = nodeCount;
+    while (true) {
+        const FlatNode& node = nodes[index];
+        if (node.childC == 0 || node.spread <= tol) return colorOf(node);
+
+        uint64_t b = node.childB, c = node.childC;
+        if (c >= end - index || (b != 0 && (b <= 1 || b >= c))) return RGBAPixel();
+        uint64_t starts[3] = { index + 1, index + (b != 0 ? b : c), index + c };
+        uint64_t ends[3] = { starts[1], index + c, end };
+
+        // Descend into the child containing the pixel; B's range is empty if there is none
+        bool found = false;
+        for (unsigned int i = 0; i < 3 && !found; i++) {
+            found = starts[i] < ends[i] && contains(nodes[starts[i]]);
+            if (found) {
+                index = starts[i];
+                end = ends[i];
+            }
+        }
+        if (!found) return RGBAPixel();
+    }
+}
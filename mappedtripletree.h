@@ -0,0 +1,144 @@
+/**
+ * @file        mappedtripletree.h
+ * @description Read-only TripleTrees used in place from a memory-mapped
+ *              file, without building any Nodes.
+ */
+
+#ifndef _MAPPEDTRIPLETREE_H_
+#define _MAPPEDTRIPLETREE_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "tripletree.h"
+#include "cs221util/MappedFile.h"
+
+/**
+ * A TripleTree stored in a flat .ttflat file whose bytes are the in-memory
+ * representation: a fixed header followed by an array of fixed-width nodes
+ * in preorder, linked by offsets relative to each node. Opening a file maps
+ * it and checks the header, so it takes the same time whatever the size of
+ * the tree; pages of nodes are only read from disk when a query touches
+ * them.
+ *
+ * Every node also stores how far its farthest leaf is from its average, so
+ * the tree can be viewed as if pruned at any tolerance without modifying
+ * it: Render(tol) and NumLeaves(tol) match Prune(tol) on the original tree.
+ *
+ * Files are written in the byte order of the machine writing them, which
+ * the header records; machines of the other byte order refuse to open
+ * them rather than swap every field.
+ */
+class MappedTripleTree {
+public:
+    /**
+     * Creates an object with no tree open.
+     */
+    MappedTripleTree();
+
+    /* The nodes may live in a mapping owned by this object */
+    MappedTripleTree(const MappedTripleTree&) = delete;
+    MappedTripleTree& operator=(const MappedTripleTree&) = delete;
+
+    /**
+     * Lays out a tree in the flat format.
+     *
+     * @param tree - the tree to be written
+     * @param out - receives the file contents
+     * @return true unless some internal node lacks an A or C child
+     */
+    static bool Write(const TripleTree& tree, vector<unsigned char>& out);
+
+    /**
+     * Writes a tree to a .ttflat file.
+     *
+     * @param tree - the tree to be written
+     * @param fileName - name of the file to be written
+     * @return true if the file was written
+     */
+    static bool Write(const TripleTree& tree, const string& fileName);
+
+    /**
+     * Maps a .ttflat file and uses it in place, closing any previous tree.
+     *
+     * @param fileName - name of the file to be opened
+     * @return true if the file holds a tree this machine can read
+     */
+    bool Open(const string& fileName);
+
+    /**
+     * Uses a .ttflat image already in memory, e.g. one made by Write,
+     * closing any previous tree. Nothing is copied, so data must outlive
+     * its use here and be 8-byte aligned.
+     *
+     * @param data - the file contents
+     * @param size - number of bytes at data
+     * @return true if data holds a tree this machine can read
+     */
+    bool Open(const unsigned char* data, size_t size);
+
+    /**
+     * Closes the tree, unmapping its file if it has one.
+     */
+    void Close();
+
+    /* Dimensions of the tree's image; 0 x 0 if no tree is open */
+    unsigned int Width() const;
+    unsigned int Height() const;
+
+    /**
+     * Returns the number of leaves, as stored when the file was written.
+     */
+    int NumLeaves() const;
+
+    /**
+     * Returns the number of leaves the tree would have after Prune(tol).
+     *
+     * @param tol - maximum allowable RGBA color distance to qualify for pruning
+     */
+    int NumLeaves(double tol) const;
+
+    /**
+     * Draws every leaf's rectangle in its average color, like
+     * TripleTree::Render.
+     */
+    PNG Render() const;
+
+    /**
+     * Renders the tree as it would be after Prune(tol).
+     *
+     * @param tol - maximum allowable RGBA color distance to qualify for pruning
+     */
+    PNG Render(double tol) const;
+
+    /**
+     * Returns the color Render(tol) gives pixel (x, y), descending only the
+     * path to that pixel; RGBAPixel() if it is outside every leaf, as
+     * Render leaves such pixels.
+     *
+     * @param x - column of the pixel
+     * @param y - row of the pixel
+     * @param tol - pruning tolerance; negative values prune nothing
+     */
+    RGBAPixel ColorAt(unsigned int x, unsigned int y, double tol = -1) const;
+
+private:
+    struct FileHeader;
+    struct FlatNode;
+
+    static bool flattenNode(const Node* node, vector<FlatNode>& nodes, vector<RGBAPixel>& leaves);
+    bool attach(const unsigned char* data, size_t size);
+    template <class Visit>
+    void visitLeaves(double tol, Visit visit) const;
+    static RGBAPixel colorOf(const FlatNode& node);
+
+    MappedFile file;           // mapping of the open file, if it came from one
+    const FlatNode* nodes;     // node array, in preorder
+    uint64_t nodeCount;
+    unsigned int width;        // image dimensions
+    unsigned int height;
+    uint64_t leafCount;
+};
+
+#endif
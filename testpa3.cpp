@@ -15,10 +15,13 @@
 #define IMAGE_5 "pruneto16leaves-8x5"
 #define IMAGE_6 "malachi-60x87"
 
+#include <fstream>
 #include <iostream>
 #include <string>
 
 #include "tripletree.h"
+#include "mappedtripletree.h"
+#include "cs221util/lodepng/lodepng.h"
 
 using namespace std;
 
@@ -29,6 +32,13 @@ void TestBuildRender(int image_num);
 void TestFlipHorizontal(int image_num);
 void TestRotateCCW(int image_num);
 void TestPrune(double tol);
+void TestContentHash();
+void TestSerialize(int image_num);
+void TestDeserializePrefix(int image_num);
+void TestDeserializeRegion(int image_num);
+void TestMappedTripleTree(int image_num);
+void TestTruncatedFiles(int image_num);
+void TestRenderPNG(int image_num);
 
 // You should probably write tests for your copy constructor / operator=
 // and tests which combine flip/rotate/prune
@@ -54,6 +64,13 @@ int main(int argc, char* argv[]) {
 	TestFlipHorizontal(image_number);
 	TestRotateCCW(image_number);
 	TestPrune(0.1);
+	TestContentHash();
+	TestSerialize(image_number);
+	TestDeserializePrefix(image_number);
+	TestDeserializeRegion(image_number);
+	TestMappedTripleTree(image_number);
+	TestTruncatedFiles(image_number);
+	TestRenderPNG(image_number);
 
 	return 0;
 }
@@ -317,4 +334,402 @@ void TestPrune(double tol) {
 	cout << "done." << endl;
 
 	cout << "Exiting TestPrune.\n" << endl;
+}
+
+void TestContentHash() {
+	cout << "Entered TestContentHash" << endl;
+
+	// Each group holds the same 4 or 16 pixels in row-major order, in different shapes
+	unsigned int shapes[][2] = { {4, 1}, {2, 2}, {1, 4}, {16, 1}, {8, 2}, {4, 4}, {2, 8} };
+	unsigned int groups[] = { 0, 0, 0, 1, 1, 1, 1 };
+	unsigned int count = sizeof(shapes) / sizeof(shapes[0]);
+	vector<uint64_t> hashes;
+	for (unsigned int i = 0; i < count; i++) {
+		PNG image(shapes[i][0], shapes[i][1]);
+		for (unsigned int p = 0; p < shapes[i][0] * shapes[i][1]; p++) {
+			*image.getPixel(p % shapes[i][0], p / shapes[i][0]) = RGBAPixel(40 * p, 255 - 15 * p, 7 * p, 1.0);
+		}
+		hashes.push_back(image.contentHash());
+
+		PNG copy(image);
+		if (copy.contentHash() != hashes.back()) {
+			cout << "FAILED: copies of a " << shapes[i][0] << "x" << shapes[i][1] << " image hash differently" << endl;
+		}
+	}
+
+	bool distinct = true;
+	for (unsigned int i = 0; i < count; i++) {
+		for (unsigned int j = i + 1; j < count; j++) {
+			if (groups[i] == groups[j] && hashes[i] == hashes[j]) {
+				cout << "FAILED: " << shapes[i][0] << "x" << shapes[i][1] << " and " << shapes[j][0] << "x" << shapes[j][1]
+				     << " images of the same pixels hash the same" << endl;
+				distinct = false;
+			}
+		}
+	}
+	cout << "Same pixels in different shapes hash differently: " << (distinct ? "yes" : "no") << endl;
+
+	cout << "Exiting TestContentHash.\n" << endl;
+}
+
+// Path of test image image_num in images-original/, or of the last image if out of range
+string TestImagePath(int image_num) {
+	const char* names[] = { IMAGE_1, IMAGE_2, IMAGE_3, IMAGE_4, IMAGE_5, IMAGE_6 };
+	if (image_num < 1 || image_num > 6)
+		image_num = 6;
+	return string("images-original/") + names[image_num - 1] + ".png";
+}
+
+const TripleTree::TreeEncoding TEST_ENCODINGS[] = { TripleTree::TTREE_DEFLATE, TripleTree::TTREE_RANGE_CODED,
+                                                    TripleTree::TTREE_PROGRESSIVE, TripleTree::TTREE_TILED };
+const char* TEST_ENCODING_NAMES[] = { "TTREE_DEFLATE", "TTREE_RANGE_CODED", "TTREE_PROGRESSIVE", "TTREE_TILED" };
+
+void TestSerialize(int image_num) {
+	cout << "Entered TestSerialize" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestSerialize.\n" << endl;
+		return;
+	}
+
+	bool passed = true;
+	double tols[] = { 0, 0.1 };
+	for (double tol : tols) {
+		TripleTree t(input);
+		t.Prune(tol);
+		PNG expected = t.Render();
+
+		for (unsigned int e = 0; e < 4; e++) {
+			vector<unsigned char> bytes;
+			TripleTree u;
+			if (!t.Serialize(bytes, TEST_ENCODINGS[e]) || !u.Deserialize(bytes.data(), bytes.size())) {
+				cout << "FAILED: " << TEST_ENCODING_NAMES[e] << " round trip at tolerance " << tol << " was not decoded" << endl;
+				passed = false;
+			}
+			else if (u.NumLeaves() != t.NumLeaves() || !expected.compare(u.Render(), false).equal) {
+				cout << "FAILED: " << TEST_ENCODING_NAMES[e] << " round trip at tolerance " << tol << " renders differently" << endl;
+				passed = false;
+			}
+			else {
+				cout << TEST_ENCODING_NAMES[e] << " at tolerance " << tol << ": " << bytes.size() << " bytes, "
+				     << u.NumLeaves() << " leaves" << endl;
+			}
+		}
+	}
+
+	// once more through a file
+	TripleTree t(input);
+	TripleTree u;
+	string output_path = "images-output/serialize.ttree";
+	if (!t.Serialize(output_path) || !u.Deserialize(output_path) || !t.Render().compare(u.Render(), false).equal) {
+		cout << "FAILED: round trip through " << output_path << endl;
+		passed = false;
+	}
+	cout << "Deserialized trees render like the originals: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestSerialize.\n" << endl;
+}
+
+void TestDeserializePrefix(int image_num) {
+	cout << "Entered TestDeserializePrefix" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestDeserializePrefix.\n" << endl;
+		return;
+	}
+	TripleTree t(input);
+	PNG expected = t.Render();
+	vector<unsigned char> bytes;
+	t.Serialize(bytes, TripleTree::TTREE_PROGRESSIVE);
+
+	// each longer prefix must give a preview of the whole image with at least as many leaves
+	bool passed = true;
+	int previous = 0;
+	cout << "Leaves decoded from eighths of the file:";
+	for (size_t k = 1; k <= 8; k++) {
+		size_t size = bytes.size() * k / 8;
+		TripleTree u;
+		bool complete = false;
+		if (!u.DeserializePrefix(bytes.data(), size, complete)) {
+			cout << " -";
+			if (k == 8)
+				passed = false;
+			continue;
+		}
+		PNG preview = u.Render();
+		cout << " " << u.NumLeaves();
+		if (u.NumLeaves() < previous || complete != (k == 8) || preview.width() != input.width()
+		    || preview.height() != input.height() || (complete && !expected.compare(preview, false).equal)) {
+			passed = false;
+		}
+		previous = u.NumLeaves();
+	}
+	cout << endl;
+
+	// other encodings only decode whole
+	TripleTree u;
+	bool complete = false;
+	t.Serialize(bytes, TripleTree::TTREE_RANGE_CODED);
+	if (u.DeserializePrefix(bytes.data(), bytes.size() / 2, complete)
+	    || !u.DeserializePrefix(bytes.data(), bytes.size(), complete) || !complete) {
+		cout << "FAILED: a TTREE_RANGE_CODED prefix was not all or nothing" << endl;
+		passed = false;
+	}
+	cout << "Prefixes decoded as previews: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestDeserializePrefix.\n" << endl;
+}
+
+void TestDeserializeRegion(int image_num) {
+	cout << "Entered TestDeserializeRegion" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestDeserializeRegion.\n" << endl;
+		return;
+	}
+	TripleTree t(input);
+	PNG expected = t.Render();
+	unsigned int w = input.width();
+	unsigned int h = input.height();
+	unsigned int rects[][4] = { {0, 0, w, h}, {0, 0, 1, 1}, {w / 2, h / 2, w - w / 2, h - h / 2}, {w / 3, 0, 1, h} };
+
+	bool passed = true;
+	unsigned int depths[] = { 2, TripleTree::TTREE_TILE_DEPTH };
+	for (unsigned int depth : depths) {
+		vector<unsigned char> bytes;
+		t.SerializeTiled(bytes, depth);
+		for (auto& r : rects) {
+			TripleTree u;
+			if (!u.DeserializeRegion(bytes.data(), bytes.size(), r[0], r[1], r[2], r[3])) {
+				cout << "FAILED: region was not decoded" << endl;
+				passed = false;
+				continue;
+			}
+			// pixels in the rectangle must be exact; tiles outside it may be averaged
+			PNG output = u.Render();
+			for (unsigned int y = r[1]; y < r[1] + r[3]; y++) {
+				for (unsigned int x = r[0]; x < r[0] + r[2]; x++) {
+					RGBAPixel* a = expected.getPixel(x, y);
+					RGBAPixel* b = output.getPixel(x, y);
+					if (a->r != b->r || a->g != b->g || a->b != b->b || a->a != b->a)
+						passed = false;
+				}
+			}
+			if (u.NumLeaves() > t.NumLeaves())
+				passed = false;
+			cout << "Tile depth " << depth << ", " << r[2] << "x" << r[3] << " at (" << r[0] << ", " << r[1] << "): "
+			     << u.NumLeaves() << " of " << t.NumLeaves() << " leaves" << endl;
+		}
+	}
+
+	// through a memory-mapped file
+	TripleTree u;
+	string output_path = "images-output/region.ttree";
+	if (!t.Serialize(output_path, TripleTree::TTREE_TILED) || !u.DeserializeRegion(output_path, 0, 0, w, h)
+	    || !expected.compare(u.Render(), false).equal) {
+		cout << "FAILED: region of " << output_path << endl;
+		passed = false;
+	}
+	cout << "Regions render like the whole tree: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestDeserializeRegion.\n" << endl;
+}
+
+void TestMappedTripleTree(int image_num) {
+	cout << "Entered TestMappedTripleTree" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestMappedTripleTree.\n" << endl;
+		return;
+	}
+	TripleTree t(input);
+	vector<unsigned char> bytes;
+	MappedTripleTree m;
+	bool passed = MappedTripleTree::Write(t, bytes) && m.Open(bytes.data(), bytes.size());
+	if (!passed || m.Width() != input.width() || m.Height() != input.height() || m.NumLeaves() != t.NumLeaves()
+	    || !t.Render().compare(m.Render(), false).equal) {
+		cout << "FAILED: flat tree differs from the tree it was written from" << endl;
+		passed = false;
+	}
+
+	// viewing at a tolerance must match pruning a copy
+	double tols[] = { 0, 0.05, 0.2 };
+	for (double tol : tols) {
+		TripleTree pruned(input);
+		pruned.Prune(tol);
+		PNG expected = pruned.Render();
+		bool same = m.NumLeaves(tol) == pruned.NumLeaves() && expected.compare(m.Render(tol), false).equal;
+		for (unsigned int y = 0; y < input.height(); y += 3) {
+			for (unsigned int x = 0; x < input.width(); x += 3) {
+				RGBAPixel c = m.ColorAt(x, y, tol);
+				RGBAPixel* e = expected.getPixel(x, y);
+				if (c.r != e->r || c.g != e->g || c.b != e->b || c.a != e->a)
+					same = false;
+			}
+		}
+		cout << "Tolerance " << tol << ": " << m.NumLeaves(tol) << " leaves, pruned copy has " << pruned.NumLeaves() << endl;
+		passed = passed && same;
+	}
+
+	// through a memory-mapped file
+	MappedTripleTree f;
+	string output_path = "images-output/mapped.ttflat";
+	if (!MappedTripleTree::Write(t, output_path) || !f.Open(output_path) || !t.Render().compare(f.Render(), false).equal) {
+		cout << "FAILED: " << output_path << " differs from the tree it was written from" << endl;
+		passed = false;
+	}
+	cout << "Flat trees render like pruned trees: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestMappedTripleTree.\n" << endl;
+}
+
+void TestTruncatedFiles(int image_num) {
+	cout << "Entered TestTruncatedFiles" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestTruncatedFiles.\n" << endl;
+		return;
+	}
+	TripleTree t(input);
+
+	// the first bytes one by one, then evenly spaced lengths, then the last bytes one by one
+	bool passed = true;
+	for (unsigned int e = 0; e <= 4; e++) {
+		vector<unsigned char> bytes;
+		if (e < 4)
+			t.Serialize(bytes, TEST_ENCODINGS[e]);
+		else
+			MappedTripleTree::Write(t, bytes);
+		vector<size_t> sizes;
+		for (size_t size = 0; size < bytes.size(); size++) {
+			if (size < 64 || size % (bytes.size() / 16 + 1) == 0 || size + 8 >= bytes.size())
+				sizes.push_back(size);
+		}
+
+		size_t accepted = 0;
+		for (size_t size : sizes) {
+			if (e < 4) {
+				// a rejected file leaves the tree unchanged
+				TripleTree u(input);
+				u.Prune(0.1);
+				int leaves = u.NumLeaves();
+				if (u.Deserialize(bytes.data(), size) || u.NumLeaves() != leaves)
+					accepted++;
+			}
+			else {
+				MappedTripleTree m;
+				if (m.Open(bytes.data(), size))
+					accepted++;
+			}
+		}
+		cout << (e < 4 ? TEST_ENCODING_NAMES[e] : ".ttflat") << ": " << accepted << " of " << sizes.size()
+		     << " truncations accepted" << endl;
+		passed = passed && accepted == 0;
+	}
+
+	// a truncated file on disk
+	vector<unsigned char> bytes;
+	t.Serialize(bytes);
+	TripleTree u;
+	string output_path = "images-output/truncated.ttree";
+	ofstream file(output_path, ios::binary);
+	file.write((const char*) bytes.data(), bytes.size() / 2);
+	file.close();
+	if (u.Deserialize(output_path)) {
+		cout << "FAILED: " << output_path << " was accepted" << endl;
+		passed = false;
+	}
+	cout << "Truncated files rejected: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestTruncatedFiles.\n" << endl;
+}
+
+// Whether RGBA8 pixels decoded from a PNG are image's, as PNG::writeToFile stores them
+bool SameRGBA8(const vector<unsigned char>& pixels, unsigned int width, unsigned int height, PNG& image) {
+	if (width != image.width() || height != image.height() || pixels.size() != (size_t) width * height * 4)
+		return false;
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			RGBAPixel* p = image.getPixel(x, y);
+			const unsigned char* q = &pixels[((size_t) y * width + x) * 4];
+			if (q[0] != p->r || q[1] != p->g || q[2] != p->b || q[3] != (unsigned char) (p->a * 255))
+				return false;
+		}
+	}
+	return true;
+}
+
+void TestRenderPNG(int image_num) {
+	cout << "Entered TestRenderPNG" << endl;
+
+	PNG input;
+	string input_path = TestImagePath(image_num);
+	if (!input.readFromFile(input_path)) {
+		cout << "FAILED: could not read " << input_path << endl;
+		cout << "Exiting TestRenderPNG.\n" << endl;
+		return;
+	}
+
+	// a translucent copy, for the RGBA and translucent palette paths
+	PNG translucent(input);
+	for (unsigned int y = 0; y < translucent.height(); y++) {
+		for (unsigned int x = 0; x < translucent.width(); x++)
+			translucent.getPixel(x, y)->a = ((x / 2 + y) % 3) / 2.0;
+	}
+
+	const char* color_types[] = { "gray", "", "RGB", "palette", "gray + alpha", "", "RGBA" };
+	bool passed = true;
+	double tols[] = { 0, 0.05, 0.2, 0.5, 1 };
+	for (unsigned int variant = 0; variant < 3; variant++) {
+		for (double tol : tols) {
+			TripleTree t(variant == 2 ? translucent : input);
+			t.Prune(tol);
+			if (variant == 1)
+				t.FlipHorizontal();
+			PNG expected = t.Render();
+
+			vector<unsigned char> bytes, pixels;
+			unsigned int width = 0, height = 0;
+			lodepng::State state;
+			if (!t.RenderPNG(bytes) || lodepng_inspect(&width, &height, &state, bytes.data(), bytes.size())
+			    || lodepng::decode(pixels, width, height, bytes) || !SameRGBA8(pixels, width, height, expected)) {
+				cout << "FAILED: RenderPNG at tolerance " << tol << " decodes to different pixels than Render" << endl;
+				passed = false;
+				continue;
+			}
+			cout << (variant == 0 ? "Tree" : variant == 1 ? "Flipped tree" : "Translucent tree") << " at tolerance "
+			     << tol << ": " << t.NumLeaves() << " leaves, " << color_types[state.info_png.color.colortype] << " "
+			     << state.info_png.color.bitdepth << "-bit, " << bytes.size() << " bytes" << endl;
+		}
+	}
+
+	// through a file
+	TripleTree t(translucent);
+	vector<unsigned char> pixels;
+	unsigned int width = 0, height = 0;
+	PNG expected = t.Render();
+	string output_path = "images-output/renderpng.png";
+	if (!t.RenderToFile(output_path) || lodepng::decode(pixels, width, height, output_path)
+	    || !SameRGBA8(pixels, width, height, expected)) {
+		cout << "FAILED: " << output_path << " decodes to different pixels than Render" << endl;
+		passed = false;
+	}
+	cout << "Rendered PNGs decode to Render's pixels: " << (passed ? "yes" : "no") << endl;
+
+	cout << "Exiting TestRenderPNG.\n" << endl;
 }
\ No newline at end of file
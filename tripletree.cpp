@@ -6,6 +6,18 @@
  */
 
 #include "tripletree.h"
+#include "tripletreebuilder.h"
+
+// Leaf batch sizes used by Prune when calling the batch distance kernel
+static const size_t PRUNE_FIRST_BATCH = 4;
+static const size_t PRUNE_BATCH_SIZE = 64;
+
+/**
+ * Constructor for an empty tree, e.g. to Deserialize into.
+ */
+TripleTree::TripleTree() {
+    root = nullptr;
+}
 
  /**
       * Constructor that builds a TripleTree out of the given PNG.
@@ -61,6 +73,34 @@ TripleTree::TripleTree(PNG& imIn) {
     root = BuildNode(imIn, {0, 0}, imIn.width(), imIn.height());
 }
 
+/**
+ * Constructor that builds a TripleTree out of a view of an image,
+ * following the same splitting rules as TripleTree(PNG&). The view is
+ * treated as a whole image: the root's upper left corner is (0,0) and
+ * Render produces a view-sized PNG. Pixels are read in place, so tiles
+ * of a large image can be compressed independently without copying.
+ *
+ * @param view - the region of an image used to construct the tree
+ */
+TripleTree::TripleTree(const ImageView& view) {
+    root = BuildNode(view, {0, 0}, view.width(), view.height());
+}
+
+/**
+ * Constructor that takes the tree finished by a TripleTreeBuilder,
+ * which is left without one. If the builder has not received all of
+ * its rows, the tree is empty instead.
+ *
+ * @param builder - the builder whose tree is taken
+ */
+TripleTree::TripleTree(TripleTreeBuilder& builder) {
+    root = nullptr;
+    if (builder.Complete()) {
+        root = builder.tree.root;
+        builder.tree.root = nullptr;
+    }
+}
+
 /**
  * Render returns a PNG image consisting of the pixels
  * stored in the tree. It may be used on pruned trees. Draws
@@ -91,7 +131,8 @@ PNG TripleTree::Render() const {
  * @param tol - maximum allowable RGBA color distance to qualify for pruning
  */
 void TripleTree::Prune(double tol) {
-    pruneNode(root, tol);
+    vector<RGBAPixel> batch(PRUNE_BATCH_SIZE);
+    pruneNode(root, tol, batch.data());
 }
 
 /**
@@ -159,6 +200,15 @@ void TripleTree::Copy(const TripleTree& other) {
  * @param h - height of node to be built's rectangle.
  */
 Node* TripleTree::BuildNode(PNG& im, pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h) {
+    return BuildNode(ImageView(im), ul, w, h);
+}
+
+/*
+ * View-based builder; im holds the image rows from row top onwards, so a
+ * band of rows can be built with the nodes still carrying image coordinates.
+ */
+Node* TripleTree::BuildNode(const ImageView& im, pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h,
+                            unsigned int top) {
     if ((w == 0) || (h == 0)) {
         return nullptr;
     }
@@ -166,47 +216,56 @@ Node* TripleTree::BuildNode(PNG& im, pair<unsigned int, unsigned int> ul, unsign
     Node* node = new Node(ul, w, h); 
 
     if ((w == 1) && (h == 1)) {
-        node->avg = *im.getPixel(ul.first, ul.second);
+        node->avg = im.row(ul.second - top)[ul.first];
         return node;
     }
 
-    int length = (w > h) ? w : h;
-    int partA = length / 3;
-    int partB = partA;
-
-    if (length % 3 == 1) {
-        partB++;
-    } else if (length % 3 == 2) {
-        partA++;
-    }
+    unsigned int partA, partB;
+    splitLengths((w > h) ? w : h, partA, partB);
 
     if (w < h) {
         pair<unsigned int, unsigned int> ul_B(ul.first, ul.second + partA);
         pair<unsigned int, unsigned int> ul_C(ul.first, ul.second + partA + partB);
 
-        node->A = BuildNode(im, ul, w, partA);
-        node->B = BuildNode(im, ul_B, w, partB);
-        node->C = BuildNode(im, ul_C, w, partA);
+        node->A = BuildNode(im, ul, w, partA, top);
+        node->B = BuildNode(im, ul_B, w, partB, top);
+        node->C = BuildNode(im, ul_C, w, partA, top);
 
         computeAvgColor(node);
     } else {
         pair<unsigned int, unsigned int> ul_B(ul.first + partA, ul.second);
         pair<unsigned int, unsigned int> ul_C(ul.first + partA + partB, ul.second);
 
-        node->A = BuildNode(im, ul, partA, h);
-        node->B = BuildNode(im, ul_B, partB, h);
-        node->C = BuildNode(im, ul_C, partA, h);
+        node->A = BuildNode(im, ul, partA, h, top);
+        node->B = BuildNode(im, ul_B, partB, h, top);
+        node->C = BuildNode(im, ul_C, partA, h, top);
         computeAvgColor(node);
     }
 
     return node;
 }
 
+/*
+ * Lengths of the strips a side of the given length is split into: A and C
+ * get partA each and B (in the middle) gets partB, which may be 0.
+ */
+void TripleTree::splitLengths(unsigned int length, unsigned int& partA, unsigned int& partB) {
+    partA = length / 3;
+    partB = partA;
+
+    if (length % 3 == 1) {
+        partB++;
+    } else if (length % 3 == 2) {
+        partA++;
+    }
+}
+
 void TripleTree::computeAvgColor(Node* node) {
-    int totalArea = node->width * node->height;
-    int areaA = (node->A != nullptr) ? node->A->width * node->A->height : 0;
-    int areaB = (node->B != nullptr) ? node->B->width * node->B->height : 0;
-    int areaC = (node->C != nullptr) ? node->C->width * node->C->height : 0;
+    // 64-bit areas: channel * area sums overflow int beyond about 8 megapixels
+    uint64_t totalArea = (uint64_t) node->width * node->height;
+    uint64_t areaA = (node->A != nullptr) ? (uint64_t) node->A->width * node->A->height : 0;
+    uint64_t areaB = (node->B != nullptr) ? (uint64_t) node->B->width * node->B->height : 0;
+    uint64_t areaC = (node->C != nullptr) ? (uint64_t) node->C->width * node->C->height : 0;
 
     char red, green, blue;
     double alpha;
@@ -230,9 +289,10 @@ void TripleTree::renderTree(PNG& im, Node* node) const {
     if (!node) return; // Base case: node is null
 
     if (!node->A && !node->B && !node->C) { // Leaf node
-        for (unsigned x = node->upperleft.first; x < node->upperleft.first + node->width; ++x) {
-            for (unsigned y = node->upperleft.second; y < node->upperleft.second + node->height; ++y) {
-                *im.getPixel(x, y) = node->avg;
+        for (unsigned y = node->upperleft.second; y < node->upperleft.second + node->height; ++y) {
+            RGBAPixel* row = im.row(y) + node->upperleft.first;
+            for (unsigned x = 0; x < node->width; ++x) {
+                row[x] = node->avg;
             }
         }
     } else { // Recursive case: has children
@@ -242,25 +302,45 @@ void TripleTree::renderTree(PNG& im, Node* node) const {
     }
 }
 
-bool TripleTree::shouldPrune(const Node* node, const RGBAPixel& avg, double tol) const {
+/*
+ * Leaves are checked against the subtree's average in batches through the
+ * vectorized distance kernel. The first batch is small so that subtrees that
+ * fail early (most of them, near the top of the tree) stay cheap; later
+ * batches grow up to PRUNE_BATCH_SIZE leaves.
+ */
+bool TripleTree::shouldPrune(const Node* node, const RGBAPixel& avg, double tol, RGBAPixel* batch) const {
+    size_t count = 0;
+    size_t limit = PRUNE_FIRST_BATCH;
+    return gatherLeaves(node, avg, tol, batch, count, limit) && allWithinDistance(avg, batch, count, tol);
+}
+
+bool TripleTree::gatherLeaves(const Node* node, const RGBAPixel& avg, double tol,
+                              RGBAPixel* batch, size_t& count, size_t& limit) const {
     if (!node) return true;
     if (!node->A && !node->B && !node->C) {
-        RGBAPixel tempAvg = node->avg;
-        return tempAvg.distanceTo(avg) <= tol;
+        batch[count++] = node->avg;
+        if (count == limit) {
+            if (!allWithinDistance(avg, batch, count, tol)) return false;
+            count = 0;
+            limit = std::min(2 * limit, PRUNE_BATCH_SIZE);
+        }
+        return true;
     }
-    return shouldPrune(node->A, avg, tol) && shouldPrune(node->B, avg, tol) && shouldPrune(node->C, avg, tol);
+    return gatherLeaves(node->A, avg, tol, batch, count, limit) &&
+           gatherLeaves(node->B, avg, tol, batch, count, limit) &&
+           gatherLeaves(node->C, avg, tol, batch, count, limit);
 }
 
-void TripleTree::pruneNode(Node*& node, double tol) {
+void TripleTree::pruneNode(Node*& node, double tol, RGBAPixel* batch) {
     if (!node) return;
-    if (shouldPrune(node, node->avg, tol)) {
+    if (shouldPrune(node, node->avg, tol, batch)) {
         clearNode(node->A);
         clearNode(node->B);
         clearNode(node->C);
     } else {
-        pruneNode(node->A, tol);
-        pruneNode(node->B, tol);
-        pruneNode(node->C, tol);
+        pruneNode(node->A, tol, batch);
+        pruneNode(node->B, tol, batch);
+        pruneNode(node->C, tol, batch);
     }
 }
 
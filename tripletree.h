@@ -10,10 +10,14 @@
 
 #include "cs221util/PNG.h"
 #include "cs221util/RGBAPixel.h"
+#include "cs221util/ImageView.h"
 
 using namespace std;
 using namespace cs221util;
 
+class TripleTreeBuilder;
+class MappedTripleTree;
+
 /**
  * The Node class *should be* private to the tree class via the principle of
  * encapsulation---the end user does not need to know our node-based
@@ -91,6 +95,11 @@ public:
 
     /* =============== public PA3 FUNCTIONS =========================*/
 
+    /**
+     * Constructor for an empty tree, e.g. to Deserialize into.
+     */
+    TripleTree();
+
     /**
      * Constructor that builds a TripleTree out of the given PNG.
      *
@@ -143,6 +152,26 @@ public:
      */
     TripleTree(PNG& imIn);
 
+    /**
+     * Constructor that builds a TripleTree out of a view of an image,
+     * following the same splitting rules as TripleTree(PNG&). The view is
+     * treated as a whole image: the root's upper left corner is (0,0) and
+     * Render produces a view-sized PNG. Pixels are read in place, so tiles
+     * of a large image can be compressed independently without copying.
+     *
+     * @param view - the region of an image used to construct the tree
+     */
+    TripleTree(const ImageView& view);
+
+    /**
+     * Constructor that takes the tree finished by a TripleTreeBuilder,
+     * which is left without one. If the builder has not received all of
+     * its rows, the tree is empty instead.
+     *
+     * @param builder - the builder whose tree is taken
+     */
+    TripleTree(TripleTreeBuilder& builder);
+
     /**
      * Render returns a PNG image consisting of the pixels
      * stored in the tree. It may be used on pruned trees. Draws
@@ -153,6 +182,28 @@ public:
      */
     PNG Render() const;
 
+    /**
+     * Encodes the image Render would return as a PNG without rendering
+     * it. The palette comes from the leaves' colors: trees with at most
+     * 256 of them are written as palette images, packed to 1, 2 or 4 bits
+     * per pixel when the colors allow, and others as RGB, or RGBA if any
+     * leaf is translucent. No pass over the pixels looks for colors, and
+     * the file decodes to the same pixels as Render().writeToFile's.
+     *
+     * @param out - receives the PNG file contents
+     * @return true unless the tree is empty or encoding failed
+     */
+    bool RenderPNG(vector<unsigned char>& out) const;
+
+    /**
+     * Writes the image Render would return to a PNG file, as RenderPNG
+     * encodes it.
+     *
+     * @param fileName - name of the file to be written
+     * @return true if the file was written
+     */
+    bool RenderToFile(const string& fileName) const;
+
     /*
      * Prune function trims subtrees as high as possible in the tree.
      * A subtree is pruned (cleared) if all of its leaves are within
@@ -191,9 +242,166 @@ public:
      */
     int NumLeaves() const;
 
+    /**
+     * Encodings of the .ttree format, stored in its version byte.
+     */
+    enum TreeEncoding {
+        TTREE_DEFLATE = 1,      // structure bits and leaf colors, deflated
+        TTREE_RANGE_CODED = 2,  // context-modeled flags and predicted colors, range coded
+        TTREE_PROGRESSIVE = 3,  // as TTREE_RANGE_CODED, breadth first so prefixes decode
+        TTREE_TILED = 4         // as TTREE_RANGE_CODED, split into independently decodable subtrees
+    };
+
+    /* Depth of the tiles of TTREE_TILED encodings written by Serialize */
+    static const unsigned int TTREE_TILE_DEPTH = 4;
+
+    /**
+     * Encodes the tree in the compact .ttree format. Only the root
+     * dimensions, one structure bit per node (internal or leaf; 1x1 nodes
+     * are always leaves and take none), one split-direction bit per square
+     * internal node, and RGBA8 colors (a = alpha * 255, as
+     * PNG::writeToFile stores it) are stored. All other geometry follows
+     * from the split rule, so the encoding is only possible for trees that
+     * follow it. Pruned and flipped trees do, but RotateCCW does not always
+     * keep it, so rotated trees may be refused.
+     *
+     * Every file starts with "TTRE", the encoding as a version byte, and
+     * the root width and height (32-bit little endian). Then:
+     *
+     * TTREE_DEFLATE: the leaf count and structure size in bytes (32-bit
+     *   little endian), then one zlib stream holding the structure bits in
+     *   preorder (least significant bit first) followed by the leaf colors
+     *   in preorder as r, g, b, a bytes. This is the default; deflate's
+     *   long-range matches make it the smallest on flat and repetitive
+     *   images.
+     *
+     * TTREE_RANGE_CODED: one range-coded stream of the nodes in preorder.
+     *   Structure bits are coded with contexts chosen by depth. Every
+     *   node's color, internal nodes included, is coded as a residual from
+     *   a prediction based on its parent's, so mostly small residuals
+     *   remain and internal averages survive the round trip. It is
+     *   smaller than TTREE_DEFLATE on photographic images, but larger
+     *   and slower to decode on flat or upscaled ones.
+     *
+     * TTREE_PROGRESSIVE: coded like TTREE_RANGE_CODED, but breadth first,
+     *   a level of the tree at a time, for DeserializePrefix. It is
+     *   usually smaller than preorder, since the adaptive contexts see
+     *   the nodes of one depth together.
+     *
+     * TTREE_TILED: the tile depth and the number of tiles N (32-bit little
+     *   endian), then N + 2 file offsets (64-bit little endian) delimiting
+     *   N + 1 range-coded streams. The first holds the top of the tree in
+     *   preorder, down to the nodes at the tile depth. The internal ones
+     *   among those are the tiles, and each following stream holds what
+     *   lies below one tile, in preorder. Every tile stream starts from
+     *   the contexts as the top stream left them, so once the top is
+     *   decoded, tiles can be decoded on their own (DeserializeRegion) and
+     *   in parallel.
+     *
+     * @param out - receives the encoded tree
+     * @param encoding - which encoding to use
+     * @return true unless the tree does not follow the split rule
+     */
+    bool Serialize(vector<unsigned char>& out, TreeEncoding encoding = TTREE_DEFLATE) const;
+
+    /**
+     * Encodes the tree as TTREE_TILED with the given tile depth. Deeper
+     * tiles are smaller and more numerous: regions load with less
+     * decoding, but every tile costs an index entry and a few bytes of
+     * context warm-up.
+     *
+     * @param out - receives the encoded tree
+     * @param tileDepth - depth of the tile roots; 0 makes the root one tile
+     * @return true unless the tree does not follow the split rule
+     */
+    bool SerializeTiled(vector<unsigned char>& out, unsigned int tileDepth) const;
+
+    /**
+     * Writes the tree to a .ttree file.
+     *
+     * @param fileName - name of the file to be written
+     * @param encoding - which encoding to use
+     * @return true if the file was written
+     */
+    bool Serialize(const string& fileName, TreeEncoding encoding = TTREE_DEFLATE) const;
+
+    /**
+     * Replaces the tree with one decoded from the .ttree format, in
+     * any encoding. Nodes get their stored colors (alpha = byte / 255,
+     * as PNG::readFromFile decodes it); in TTREE_DEFLATE files only
+     * leaves have one, so internal nodes get averages recomputed from
+     * their children. On failure the tree is left unchanged.
+     *
+     * @param data - the encoded tree
+     * @param size - number of bytes at data
+     * @return true if data held a valid encoding
+     */
+    bool Deserialize(const unsigned char* data, size_t size);
+
+    /**
+     * Replaces the tree with the coarse version of it held by a prefix of
+     * a TTREE_PROGRESSIVE encoding, e.g. the part of a file received so
+     * far. Every node whose children are not in the prefix is a leaf with
+     * its stored average, so the tree renders as a preview of the whole
+     * image that gets finer as the prefix grows. The prefix is decoded
+     * from the start on every call. Other encodings only decode when
+     * complete. On failure the tree is left unchanged.
+     *
+     * @param data - the start of the encoded tree
+     * @param size - number of bytes at data
+     * @param complete - set to whether the whole tree was decoded
+     * @return true if data held at least the root
+     */
+    bool DeserializePrefix(const unsigned char* data, size_t size, bool& complete);
+
+    /**
+     * Replaces the tree with the part of a TTREE_TILED encoding needed to
+     * render the given rectangle: the top of the tree and the tiles that
+     * intersect the rectangle, which are decoded in parallel. Other tiles
+     * are leaves with their average color. Only the index and those tiles'
+     * streams are read. Other encodings are decoded whole. On failure the
+     * tree is left unchanged.
+     *
+     * @param data - the encoded tree
+     * @param size - number of bytes at data
+     * @param x - left edge of the rectangle
+     * @param y - top edge of the rectangle
+     * @param width - width of the rectangle
+     * @param height - height of the rectangle
+     * @return true if data held a valid encoding
+     */
+    bool DeserializeRegion(const unsigned char* data, size_t size, unsigned int x, unsigned int y,
+                           unsigned int width, unsigned int height);
+
+    /**
+     * Loads the part of a .ttree file needed to render the given
+     * rectangle. The file is memory mapped, so only the pages of the
+     * tiles in the rectangle are ever read from disk.
+     *
+     * @param fileName - name of the file to be read
+     * @param x - left edge of the rectangle
+     * @param y - top edge of the rectangle
+     * @param width - width of the rectangle
+     * @param height - height of the rectangle
+     * @return true if the file was read and decoded
+     */
+    bool DeserializeRegion(const string& fileName, unsigned int x, unsigned int y,
+                           unsigned int width, unsigned int height);
+
+    /**
+     * Replaces the tree with one read from a .ttree file.
+     *
+     * @param fileName - name of the file to be read
+     * @return true if the file was read and decoded
+     */
+    bool Deserialize(const string& fileName);
+
     /* =============== end of public PA3 FUNCTIONS =========================*/
 
 private:
+    friend class TripleTreeBuilder;
+    friend class MappedTripleTree;
+
     /*
      * Private member variables.
      *
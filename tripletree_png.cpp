@@ -0,0 +1,222 @@
+/**
+ * @file        tripletree_png.cpp
+ * @description Writing rendered TripleTrees straight to PNG, using what
+ *              the tree knows about its leaves.
+ */
+
+#include "tripletree.h"
+#include "cs221util/lodepng/lodepng.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+    // Largest palette a PNG can hold
+    const size_t PNG_PALETTE_SIZE = 256;
+    // Filter type that predicts each byte from the one above it
+    const unsigned char PNG_FILTER_UP = 2;
+
+    bool isLeaf(const Node* node) {
+        return !node->A && !node->B && !node->C;
+    }
+
+    void gatherLeaves(const Node* node, vector<const Node*>& leaves) {
+        if (!node) return;
+        if (isLeaf(node)) {
+            leaves.push_back(node);
+            return;
+        }
+        gatherLeaves(node->A, leaves);
+        gatherLeaves(node->B, leaves);
+        gatherLeaves(node->C, leaves);
+    }
+
+    // RGBA8 as PNG::writeToFile stores it, packed r first
+    uint32_t packColor(const RGBAPixel& color) {
+        unsigned char a = color.a * 255;
+        return (uint32_t) color.r | (uint32_t) color.g << 8 | (uint32_t) color.b << 16 | (uint32_t) a << 24;
+    }
+
+    /*
+     * Calls fill(leaf, y, x, count) for every row of pixels a leaf covers,
+     * clipped to the image, with leaf its position in leaves.
+     */
+    template <class Fill>
+    void fillLeaves(const vector<const Node*>& leaves, unsigned int width, unsigned int height, Fill fill) {
+        for (size_t i = 0; i < leaves.size(); i++) {
+            const Node* leaf = leaves[i];
+            unsigned int x = leaf->upperleft.first, y = leaf->upperleft.second;
+            if (x >= width || y >= height) continue;
+            unsigned int w = min(leaf->width, width - x);
+            unsigned int h = min(leaf->height, height - y);
+            for (unsigned int row = y; row < y + h; row++) {
+                fill(i, row, x, w);
+            }
+        }
+    }
+
+    /*
+     * Chooses each row's PNG filter from the leaf layout, for LFS_PREDEFINED.
+     * Up turns every pixel that continues a leaf from the row above into a
+     * zero, so it is used for rows no leaf starts on, which become all
+     * zeros, and for rows where new leaves take up at most 3/8 of the
+     * width. Rows made mostly of new leaves, such as those of unpruned
+     * detail, are left to LodePNG's minimum sum heuristic.
+     */
+    vector<unsigned char> rowFilters(const vector<const Node*>& leaves, unsigned int width, unsigned int height) {
+        // Pixels of each row covered by leaves starting on it
+        vector<uint64_t> fresh(height, 0);
+        for (const Node* leaf : leaves) {
+            if (leaf->upperleft.second < height) fresh[leaf->upperleft.second] += leaf->width;
+        }
+
+        vector<unsigned char> filters(height, LODEPNG_FILTER_MINSUM);
+        for (unsigned int y = 1; y < height; y++) {
+            if (8 * fresh[y] <= 3 * (uint64_t) width) filters[y] = PNG_FILTER_UP;
+        }
+        return filters;
+    }
+
+    /*
+     * Encodes the leaves as a palette image, bit-packed when there are at
+     * most 16 colors. colors holds the palette and index each leaf's entry;
+     * pixels no leaf covers get entry 0. Rows are left unfiltered, as the
+     * PNG specification recommends for palettes: LZ77 finds repeated rows
+     * of indices just as well.
+     */
+    unsigned encodePalette(const vector<const Node*>& leaves, const vector<uint32_t>& colors,
+                           const vector<unsigned char>& index,
+                           unsigned int width, unsigned int height, vector<unsigned char>& out) {
+        unsigned int depth = colors.size() <= 2 ? 1 : colors.size() <= 4 ? 2 : colors.size() <= 16 ? 4 : 8;
+
+        vector<unsigned char> indices((size_t) width * height, 0);
+        fillLeaves(leaves, width, height, [&](size_t leaf, unsigned int y, unsigned int x, unsigned int w) {
+            unsigned char* row = &indices[(size_t) y * width + x];
+            fill(row, row + w, index[leaf]);
+        });
+
+        // LodePNG takes sub-byte pixels packed without padding at the ends of rows
+        if (depth < 8) {
+            unsigned int perByte = 8 / depth;
+            vector<unsigned char> packed((indices.size() + perByte - 1) / perByte, 0);
+            for (size_t i = 0; i < indices.size(); i++) {
+                packed[i / perByte] |= indices[i] << (8 - depth * (i % perByte + 1));
+            }
+            indices.swap(packed);
+        }
+
+        lodepng::State state;
+        state.encoder.auto_convert = 0;
+        // Large renders are deflated in chunks on every core
+        state.encoder.zlibsettings.threads = 0;
+        state.info_raw.colortype = LCT_PALETTE;
+        state.info_raw.bitdepth = depth;
+        for (size_t i = 0; i < colors.size(); i++) {
+            unsigned error = lodepng_palette_add(&state.info_raw, colors[i] & 255, (colors[i] >> 8) & 255,
+                                                 (colors[i] >> 16) & 255, colors[i] >> 24);
+            if (error) return error;
+        }
+        unsigned error = lodepng_color_mode_copy(&state.info_png.color, &state.info_raw);
+        if (error) return error;
+        return lodepng::encode(out, indices.data(), width, height, state);
+    }
+
+    // Encodes the leaves as RGB, or RGBA if any is translucent, with rowFilters
+    unsigned encodeTrueColor(const vector<const Node*>& leaves, const vector<uint32_t>& leafColors,
+                             uint32_t background, bool opaque,
+                             unsigned int width, unsigned int height, vector<unsigned char>& out) {
+        unsigned int channels = opaque ? 3 : 4;
+        vector<unsigned char> pixels((size_t) width * height * channels);
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            for (unsigned int c = 0; c < channels; c++) pixels[i * channels + c] = background >> (8 * c);
+        }
+        fillLeaves(leaves, width, height, [&](size_t leaf, unsigned int y, unsigned int x, unsigned int w) {
+            unsigned char* row = &pixels[((size_t) y * width + x) * channels];
+            for (unsigned int i = 0; i < w; i++) {
+                for (unsigned int c = 0; c < channels; c++) row[i * channels + c] = leafColors[leaf] >> (8 * c);
+            }
+        });
+
+        lodepng::State state;
+        state.encoder.auto_convert = 0;
+        state.encoder.zlibsettings.threads = 0;
+        vector<unsigned char> filters = rowFilters(leaves, width, height);
+        state.encoder.filter_strategy = LFS_PREDEFINED;
+        state.encoder.predefined_filters = filters.data();
+        state.info_raw.colortype = opaque ? LCT_RGB : LCT_RGBA;
+        state.info_raw.bitdepth = 8;
+        state.info_png.color.colortype = state.info_raw.colortype;
+        state.info_png.color.bitdepth = 8;
+        return lodepng::encode(out, pixels.data(), width, height, state);
+    }
+
+    /*
+     * Encodes the rendered tree, with the leaves' colors as the palette if
+     * there are few enough of them, and returns LodePNG's error code.
+     */
+    unsigned encodeTree(const Node* root, vector<unsigned char>& out) {
+        unsigned int width = root->width, height = root->height;
+
+        vector<const Node*> leaves;
+        gatherLeaves(root, leaves);
+
+        // Pixels no leaf covers keep the color of a fresh PNG's, as in Render
+        uint64_t covered = 0;
+        for (const Node* leaf : leaves) covered += (uint64_t) leaf->width * leaf->height;
+        bool uncovered = covered < (uint64_t) width * height;
+        uint32_t background = packColor(RGBAPixel());
+
+        vector<uint32_t> leafColors(leaves.size());
+        vector<uint32_t> colors;
+        vector<unsigned char> index(leaves.size());
+        unordered_map<uint32_t, unsigned char> palette;
+        if (uncovered) {
+            palette[background] = 0;
+            colors.push_back(background);
+        }
+        bool opaque = !uncovered || (background >> 24) == 255;
+        bool full = false;
+        for (size_t i = 0; i < leaves.size(); i++) {
+            leafColors[i] = packColor(leaves[i]->avg);
+            opaque = opaque && (leafColors[i] >> 24) == 255;
+            if (full) continue;
+
+            auto entry = palette.find(leafColors[i]);
+            if (entry == palette.end()) {
+                full = colors.size() == PNG_PALETTE_SIZE;
+                if (full) continue;
+                entry = palette.insert(make_pair(leafColors[i], (unsigned char) colors.size())).first;
+                colors.push_back(leafColors[i]);
+            }
+            index[i] = entry->second;
+        }
+
+        // As in LodePNG's own choice, tiny images aren't worth a palette's overhead
+        if (!full && (uint64_t) width * height >= 2 * colors.size()) {
+            return encodePalette(leaves, colors, index, width, height, out);
+        }
+        return encodeTrueColor(leaves, leafColors, background, opaque, width, height, out);
+    }
+}
+
+bool TripleTree::RenderPNG(vector<unsigned char>& out) const {
+    out.clear();
+    return root && encodeTree(root, out) == 0;
+}
+
+bool TripleTree::RenderToFile(const string& fileName) const {
+    if (!root) {
+        cerr << "TripleTree: " << fileName << ": the tree is empty" << endl;
+        return false;
+    }
+
+    vector<unsigned char> png;
+    unsigned error = encodeTree(root, png);
+    if (!error) error = lodepng::save_file(png, fileName);
+    if (error) {
+        cerr << "PNG encoding error " << error << ": " << lodepng_error_text(error) << endl;
+    }
+    return error == 0;
+}
@@ -10,16 +10,29 @@
  */
 
  // begin your declarations below
+Node* BuildNode(const ImageView& im, pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h, unsigned int top = 0);
 void renderTree(PNG& im, Node* node) const;
 void pruneHelper(Node* node, RGBAPixel& color, double tol);
 void flipHorizontally(Node* node);
 void rotateCounterClockwise(Node* node);
 void swapDimensions(Node* node);
 int countLeaves(Node* node) const;
-void clearNode(Node*& node);
+static void clearNode(Node*& node);
 Node* copyTree(Node* other);
+static void splitLengths(unsigned int length, unsigned int& partA, unsigned int& partB);
 void computeAvgColor(Node* node);
+void averageSubtree(Node* node);
+static bool followsSplitRule(const Node* node, bool& tall);
+class TreeCoder;
+bool serializeNode(const Node* node, vector<unsigned char>& structure, size_t& bits,
+                   vector<unsigned char>& colors) const;
+bool deserializeTiled(const unsigned char* data, size_t size, unsigned int x0, unsigned int y0,
+                      unsigned int x1, unsigned int y1, Node*& tree);
+Node* deserializeNode(pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h,
+                      const unsigned char* structure, size_t structureBits, size_t& bit,
+                      const unsigned char*& colors, const unsigned char* colorsEnd);
 double nodeColorDistance(const RGBAPixel &nodeColor, const RGBAPixel &targetColor) const;
 // double maxChildDist(Node* node, RGBAPixel& color) const;
-bool shouldPrune(const Node* node, const RGBAPixel& avg, double tol) const;
-void pruneNode(Node*& node, double tol);
\ No newline at end of file
+bool shouldPrune(const Node* node, const RGBAPixel& avg, double tol, RGBAPixel* batch) const;
+bool gatherLeaves(const Node* node, const RGBAPixel& avg, double tol, RGBAPixel* batch, size_t& count, size_t& limit) const;
+void pruneNode(Node*& node, double tol, RGBAPixel* batch);
\ No newline at end of file
@@ -0,0 +1,824 @@
+/**
+ * @file        tripletree_serialize.cpp
+ * @description Reading and writing TripleTrees in the compact .ttree format.
+ */
+
+#include "tripletree.h"
+#include "cs221util/MappedFile.h"
+#include "cs221util/RangeCoder.h"
+#include "cs221util/lodepng/lodepng.h"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace {
+    const unsigned char TTREE_MAGIC[4] = { 'T', 'T', 'R', 'E' };
+    // magic, version, width, height; deflated streams add two more counts
+    const size_t TTREE_HEADER_SIZE = 13;
+    const size_t TTREE_DEFLATE_HEADER_SIZE = 21;
+    const size_t TTREE_TILED_HEADER_SIZE = 21;
+
+    void put32(unsigned char* p, uint32_t value) {
+        p[0] = value & 255;
+        p[1] = (value >> 8) & 255;
+        p[2] = (value >> 16) & 255;
+        p[3] = value >> 24;
+    }
+
+    uint32_t get32(const unsigned char* p) {
+        return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+    }
+
+    void put64(unsigned char* p, uint64_t value) {
+        put32(p, (uint32_t) value);
+        put32(p + 4, (uint32_t) (value >> 32));
+    }
+
+    uint64_t get64(const unsigned char* p) {
+        return (uint64_t) get32(p) | (uint64_t) get32(p + 4) << 32;
+    }
+
+    void putBit(vector<unsigned char>& structure, size_t& bits, bool bit) {
+        if ((bits & 7) == 0) structure.push_back(0);
+        if (bit) structure.back() |= 1 << (bits & 7);
+        bits++;
+    }
+
+    bool isLeaf(const Node* node) {
+        return !node->A && !node->B && !node->C;
+    }
+
+    // Whether child has the position and size the split rule gives it
+    bool hasGeometry(const Node* child, unsigned int x, unsigned int y, unsigned int w, unsigned int h) {
+        if (w == 0 || h == 0) return child == nullptr;
+        return child && child->upperleft.first == x && child->upperleft.second == y &&
+               child->width == w && child->height == h;
+    }
+
+    // A node's color as stored: RGBA8, alpha scaled as PNG::writeToFile does
+    struct Color8 {
+        unsigned char c[4];
+    };
+
+    Color8 color8(const RGBAPixel& pixel) {
+        Color8 color = {{ pixel.r, pixel.g, pixel.b, (unsigned char) (pixel.a * 255) }};
+        return color;
+    }
+
+    RGBAPixel pixelOf(const Color8& color) {
+        return RGBAPixel(color.c[0], color.c[1], color.c[2], color.c[3] / 255.);
+    }
+
+    void writeHeader(vector<unsigned char>& out, size_t headerSize, unsigned char version,
+                     unsigned int width, unsigned int height) {
+        out.assign(headerSize, 0);
+        memcpy(&out[0], TTREE_MAGIC, sizeof(TTREE_MAGIC));
+        out[4] = version;
+        put32(&out[5], width);
+        put32(&out[9], height);
+    }
+}
+
+/*
+ * Model and traversal of the range-coded encodings. Every node is coded
+ * as: the leaf/internal flag (none for 1x1 nodes), in a context
+ * chosen by depth; the split direction of square internal nodes; then the
+ * node's RGBA8 color as per-channel residuals from a prediction. A and B are
+ * predicted to have their parent's color. C is predicted from the parent and
+ * its already coded siblings, as the color that makes the area-weighted
+ * average of the three come out at the parent's. Residuals are zigzag
+ * mapped so that small errors of either sign get small codes, and coded
+ * with a binary tree per channel, node kind and prediction kind, further
+ * split by the magnitude of the previous residual: the node's previous
+ * channel, or for the first channel the largest residual of the previous
+ * node of its family. Colors that are hard to predict tend to come in
+ * clusters.
+ *
+ * The three children of a node are always coded together, A, B, C. In
+ * preorder each child's subtree follows right after it; breadth first,
+ * families are coded level by level, so every prefix of the stream holds a
+ * coarser but complete tree. Tiled streams code the top of the tree in
+ * preorder and leave the families below a given depth to separate streams,
+ * one per subtree, each coded by a copy of the coder that coded the top.
+ */
+class TripleTree::TreeCoder {
+public:
+    // An internal node whose children are still to be coded
+    template <class NodeType>
+    struct Pending {
+        NodeType* node;
+        unsigned int depth;
+        unsigned int activity;    // magnitude class of the node's own residuals
+        bool tall;                // split direction (decoding only)
+    };
+
+    TreeCoder() : deferDepth(0) {
+        std::fill(&flags[0], &flags[0] + FLAG_CONTEXTS, BIT_PROBABILITY_INIT);
+        tallSplit = BIT_PROBABILITY_INIT;
+        std::fill(&residuals[0][0][0][0][0], &residuals[0][0][0][0][0] + sizeof(residuals) / sizeof(BitProbability),
+                  BIT_PROBABILITY_INIT);
+    }
+
+    /*
+     * Codes the tree under root, in preorder or breadth first. Returns
+     * false if some node does not follow the split rule.
+     */
+    bool encode(const Node* root, bool breadthFirst, RangeEncoder& encoder) {
+        deferDepth = 0;
+        unsigned int activity = 0;
+        if (!encodeNode(root, 0, rootPrediction(), 0, activity, encoder)) return false;
+        if (isLeaf(root)) return true;
+        if (!breadthFirst) return encodeChildren(root, 0, activity, nullptr, encoder);
+
+        deque<Pending<const Node>> queue(1, Pending<const Node>{ root, 0, activity, false });
+        while (!queue.empty()) {
+            Pending<const Node> next = queue.front();
+            queue.pop_front();
+            if (!encodeChildren(next.node, next.depth, next.activity, &queue, encoder)) return false;
+        }
+        return true;
+    }
+
+    /*
+     * Decodes a width x height tree, setting complete if all of it was
+     * there. Breadth first, a stream that ends early still yields the nodes
+     * decoded before that point, whole families at a time; nodes whose
+     * children are missing are left as leaves. Returns nullptr if not even
+     * the root could be decoded (or, in preorder, if anything is missing).
+     */
+    Node* decode(unsigned int width, unsigned int height, bool breadthFirst, RangeDecoder& decoder,
+                 bool& complete) {
+        complete = false;
+        deferDepth = 0;
+        unsigned int activity = 0;
+        bool internal, tall;
+        Node* root = decodeNode({0, 0}, width, height, 0, rootPrediction(), 0, activity, internal, tall, decoder);
+        if (!root) return nullptr;
+
+        if (!breadthFirst) {
+            if (internal && !decodeChildren(root, tall, 0, activity, nullptr, decoder)) {
+                clearNode(root);
+                return nullptr;
+            }
+            complete = true;
+            return root;
+        }
+
+        deque<Pending<Node>> queue;
+        if (internal) queue.push_back(Pending<Node>{ root, 0, activity, tall });
+        while (!queue.empty()) {
+            Pending<Node> next = queue.front();
+            queue.pop_front();
+            if (!decodeChildren(next.node, next.tall, next.depth, next.activity, &queue, decoder)) return root;
+        }
+        complete = true;
+        return root;
+    }
+
+    /*
+     * Codes the top of the tree under root in preorder, down to the nodes
+     * at tileDepth but not their children. The internal nodes at tileDepth,
+     * the roots of the tiles, are appended to tiles in preorder.
+     */
+    bool encodeTop(const Node* root, unsigned int tileDepth, deque<Pending<const Node>>& tiles,
+                   RangeEncoder& encoder) {
+        deferDepth = tileDepth;
+        unsigned int activity = 0;
+        if (!encodeNode(root, 0, rootPrediction(), 0, activity, encoder)) return false;
+        if (isLeaf(root)) return true;
+        if (tileDepth == 0) {
+            tiles.push_back(Pending<const Node>{ root, 0, activity, false });
+            return true;
+        }
+        return encodeChildren(root, 0, activity, &tiles, encoder);
+    }
+
+    /* The inverse of encodeTop; returns nullptr if the stream is incomplete */
+    Node* decodeTop(unsigned int width, unsigned int height, unsigned int tileDepth,
+                    deque<Pending<Node>>& tiles, RangeDecoder& decoder) {
+        deferDepth = tileDepth;
+        unsigned int activity = 0;
+        bool internal, tall;
+        Node* root = decodeNode({0, 0}, width, height, 0, rootPrediction(), 0, activity, internal, tall, decoder);
+        if (!root || !internal) return root;
+        if (tileDepth == 0) {
+            tiles.push_back(Pending<Node>{ root, 0, activity, tall });
+        } else if (!decodeChildren(root, tall, 0, activity, &tiles, decoder)) {
+            clearNode(root);
+            return nullptr;
+        }
+        return root;
+    }
+
+    /* Codes everything below the root of a tile, in preorder */
+    bool encodeTile(const Pending<const Node>& tile, RangeEncoder& encoder) {
+        return encodeChildren(tile.node, tile.depth, tile.activity, nullptr, encoder);
+    }
+
+    /* The inverse of encodeTile */
+    bool decodeTile(const Pending<Node>& tile, RangeDecoder& decoder) {
+        return decodeChildren(tile.node, tile.tall, tile.depth, tile.activity, nullptr, decoder);
+    }
+
+private:
+    static const unsigned int FLAG_CONTEXTS = 48;
+
+    /* The root is predicted as if its parent were opaque mid grey */
+    static Color8 rootPrediction() {
+        Color8 grey = {{ 128, 128, 128, 255 }};
+        return grey;
+    }
+
+    /*
+     * Codes one node: its shape, then its color. activity is the magnitude
+     * class of the residuals of the node coded just before it among its
+     * family (its parent for A, its left sibling otherwise); it is replaced
+     * by the node's own.
+     */
+    bool encodeNode(const Node* node, unsigned int depth, const Color8& predicted, unsigned int kind,
+                    unsigned int& activity, RangeEncoder& encoder) {
+        bool small = node->width == 1 && node->height == 1;
+        bool leaf = isLeaf(node);
+        bool tall = false;
+
+        if (!leaf && !followsSplitRule(node, tall)) return false;
+        if (!small) encoder.encode(flags[flagContext(depth)], leaf ? 0 : 1);
+        if (!leaf && node->width == node->height) encoder.encode(tallSplit, tall);
+
+        Color8 color = color8(node->avg);
+        unsigned int nodeKind = small ? 0 : (leaf ? 1 : 2);
+        unsigned int previous = activity, largest = 0;
+        for (unsigned int i = 0; i < 4; i++) {
+            unsigned int code = zigzag(color.c[i] - predicted.c[i]);
+            encoder.encodeTree(residuals[nodeKind][kind][i][previous], 8, code);
+            previous = magnitudeClass(code);
+            largest = std::max(largest, previous);
+        }
+        activity = largest;
+        return true;
+    }
+
+    /*
+     * Codes the children of an internal node whose residuals had the given
+     * activity. Internal children at deferDepth or below are queued, when
+     * there is a queue; the subtrees of the others follow them (preorder).
+     */
+    bool encodeChildren(const Node* node, unsigned int depth, unsigned int activity,
+                        deque<Pending<const Node>>* queue, RangeEncoder& encoder) {
+        Color8 color = color8(node->avg);
+        const Node* children[3] = { node->A, node->B, node->C };
+        for (unsigned int i = 0; i < 3; i++) {
+            const Node* child = children[i];
+            if (!child) continue;
+
+            Color8 predicted = i < 2 ? color
+                : predictLast(color, color8(node->A->avg), area(node->A),
+                              node->B ? color8(node->B->avg) : color, area(node->B), area(node->C));
+            if (!encodeNode(child, depth + 1, predicted, i / 2, activity, encoder)) return false;
+            if (isLeaf(child)) continue;
+
+            if (queue && depth + 1 >= deferDepth) queue->push_back(Pending<const Node>{ child, depth + 1, activity, false });
+            else if (!encodeChildren(child, depth + 1, activity, queue, encoder)) return false;
+        }
+        return true;
+    }
+
+    /* The inverse of encodeNode; returns nullptr if the stream ran out */
+    Node* decodeNode(pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h, unsigned int depth,
+                     const Color8& predicted, unsigned int kind, unsigned int& activity,
+                     bool& internal, bool& tall, RangeDecoder& decoder) {
+        bool small = w == 1 && h == 1;
+        internal = !small && decoder.decode(flags[flagContext(depth)]) == 1;
+        tall = w < h;
+        if (internal && w == h) tall = decoder.decode(tallSplit) == 1;
+
+        Color8 color;
+        unsigned int nodeKind = small ? 0 : (internal ? 2 : 1);
+        unsigned int previous = activity, largest = 0;
+        for (unsigned int i = 0; i < 4; i++) {
+            unsigned int code = decoder.decodeTree(residuals[nodeKind][kind][i][previous], 8);
+            color.c[i] = predicted.c[i] + unzigzag(code);
+            previous = magnitudeClass(code);
+            largest = std::max(largest, previous);
+        }
+        activity = largest;
+        if (decoder.overrun()) return nullptr;
+
+        Node* node = new Node(ul, w, h);
+        node->avg = pixelOf(color);
+        return node;
+    }
+
+    /*
+     * The inverse of encodeChildren. If the stream runs out, no children
+     * are attached and false is returned.
+     */
+    bool decodeChildren(Node* node, bool tall, unsigned int depth, unsigned int activity,
+                        deque<Pending<Node>>* queue, RangeDecoder& decoder) {
+        unsigned int w = node->width, h = node->height;
+        pair<unsigned int, unsigned int> ul = node->upperleft;
+        unsigned int partA, partB;
+        splitLengths(tall ? h : w, partA, partB);
+
+        unsigned int offsets[3] = { 0, partA, partA + partB };
+        unsigned int lengths[3] = { partA, partB, partA };
+        Node** slots[3] = { &node->A, &node->B, &node->C };
+        Color8 color = color8(node->avg);
+        bool ok = true;
+
+        for (unsigned int i = 0; i < 3 && ok; i++) {
+            if (lengths[i] == 0) continue;
+            pair<unsigned int, unsigned int> ulChild = tall ? make_pair(ul.first, ul.second + offsets[i])
+                                                            : make_pair(ul.first + offsets[i], ul.second);
+            Color8 predicted = i < 2 ? color
+                : predictLast(color, color8(node->A->avg), area(node->A),
+                              node->B ? color8(node->B->avg) : color, area(node->B), area(node->A));
+
+            bool internal, childTall;
+            Node* child = decodeNode(ulChild, tall ? w : lengths[i], tall ? lengths[i] : h, depth + 1,
+                                     predicted, i / 2, activity, internal, childTall, decoder);
+            *slots[i] = child;
+            ok = child != nullptr;
+            if (!ok || !internal) continue;
+
+            if (queue && depth + 1 >= deferDepth) queue->push_back(Pending<Node>{ child, depth + 1, activity, childTall });
+            else ok = decodeChildren(child, childTall, depth + 1, activity, queue, decoder);
+        }
+
+        if (!ok) {
+            clearNode(node->A);
+            clearNode(node->B);
+            clearNode(node->C);
+        }
+        return ok;
+    }
+
+
+    static unsigned int flagContext(unsigned int depth) {
+        return depth < FLAG_CONTEXTS ? depth : FLAG_CONTEXTS - 1;
+    }
+
+    static int64_t area(const Node* node) {
+        return node ? (int64_t) node->width * node->height : 0;
+    }
+
+    /* Buckets a zigzag code: exact, within 1, within 4, or worse */
+    static unsigned int magnitudeClass(unsigned int code) {
+        return code == 0 ? 0 : (code <= 2 ? 1 : (code <= 8 ? 2 : 3));
+    }
+
+    static unsigned int zigzag(unsigned char residual) {
+        int signedResidual = (signed char) residual;
+        return signedResidual >= 0 ? 2 * signedResidual : -2 * signedResidual - 1;
+    }
+
+    static unsigned char unzigzag(unsigned int code) {
+        return (code & 1) ? (unsigned char) (-(int) ((code + 1) / 2)) : (unsigned char) (code / 2);
+    }
+
+    /*
+     * Predicts C's color from the parent's and its siblings'. The parent's
+     * channels were truncated from the area-weighted sum, so the sum is
+     * taken as parent + 1/2 per pixel. Nodes too large for exact 64-bit
+     * arithmetic are predicted as the parent color.
+     */
+    static Color8 predictLast(const Color8& parent, const Color8& colorA, int64_t areaA,
+                              const Color8& colorB, int64_t areaB, int64_t areaC) {
+        int64_t total = areaA + areaB + areaC;
+        if (total >= (int64_t) 1 << 52) return parent;
+
+        Color8 predicted;
+        for (unsigned int i = 0; i < 4; i++) {
+            int64_t twice = (2 * parent.c[i] + 1) * total - 2 * (colorA.c[i] * areaA + colorB.c[i] * areaB);
+            int64_t value = twice <= 0 ? 0 : (twice + areaC) / (2 * areaC);
+            predicted.c[i] = value > 255 ? 255 : (unsigned char) value;
+        }
+        return predicted;
+    }
+
+    unsigned int deferDepth;                     // shallowest depth whose families may be queued
+    BitProbability flags[FLAG_CONTEXTS];         // leaf/internal flag by depth
+    BitProbability tallSplit;                    // split direction of square nodes
+    BitProbability residuals[3][2][4][4][256];   // [1x1 leaf, leaf, internal][A/B, C][channel][class of previous residual]
+};
+
+/*
+ * Checks that the children of an internal node are laid out by the split
+ * rule, which both encodings rely on. Square nodes are the only ones whose
+ * split direction can differ from the rule (rotating turns their wide splits
+ * into tall ones), so tall reports the direction found.
+ */
+bool TripleTree::followsSplitRule(const Node* node, bool& tall) {
+    unsigned int w = node->width, h = node->height;
+    unsigned int x = node->upperleft.first, y = node->upperleft.second;
+    if (w == 1 && h == 1) return false;
+
+    tall = (w < h) || (w == h && node->A && node->A->width == w);
+    unsigned int partA, partB;
+    splitLengths(tall ? h : w, partA, partB);
+    return tall
+        ? hasGeometry(node->A, x, y, w, partA) && hasGeometry(node->B, x, y + partA, w, partB) &&
+          hasGeometry(node->C, x, y + partA + partB, w, partA)
+        : hasGeometry(node->A, x, y, partA, h) && hasGeometry(node->B, x + partA, y, partB, h) &&
+          hasGeometry(node->C, x + partA + partB, y, partA, h);
+}
+
+/*
+ * Appends the node's bits and, for leaves, its color; square internal nodes
+ * also record their split direction.
+ */
+bool TripleTree::serializeNode(const Node* node, vector<unsigned char>& structure, size_t& bits,
+                               vector<unsigned char>& colors) const {
+    unsigned int w = node->width, h = node->height;
+
+    if (isLeaf(node)) {
+        if (w > 1 || h > 1) putBit(structure, bits, false);
+        Color8 color = color8(node->avg);
+        colors.insert(colors.end(), color.c, color.c + 4);
+        return true;
+    }
+    bool tall;
+    if (!followsSplitRule(node, tall)) return false;
+    putBit(structure, bits, true);
+    if (w == h) putBit(structure, bits, tall);
+
+    return serializeNode(node->A, structure, bits, colors) &&
+           (!node->B || serializeNode(node->B, structure, bits, colors)) &&
+           serializeNode(node->C, structure, bits, colors);
+}
+
+const unsigned int TripleTree::TTREE_TILE_DEPTH;
+
+bool TripleTree::Serialize(vector<unsigned char>& out, TreeEncoding encoding) const {
+    if (encoding == TTREE_TILED) return SerializeTiled(out, TTREE_TILE_DEPTH);
+    if (root && (root->upperleft.first != 0 || root->upperleft.second != 0)) return false;
+    unsigned int width = root ? root->width : 0;
+    unsigned int height = root ? root->height : 0;
+
+    if (encoding == TTREE_RANGE_CODED || encoding == TTREE_PROGRESSIVE) {
+        vector<unsigned char> stream;
+        if (root) {
+            TreeCoder coder;
+            RangeEncoder encoder(stream);
+            if (!coder.encode(root, encoding == TTREE_PROGRESSIVE, encoder)) return false;
+            encoder.finish();
+        }
+        writeHeader(out, TTREE_HEADER_SIZE, encoding, width, height);
+        out.insert(out.end(), stream.begin(), stream.end());
+        return true;
+    }
+
+    vector<unsigned char> structure, colors;
+    size_t bits = 0;
+    if (root && !serializeNode(root, structure, bits, colors)) return false;
+
+    // The structure and colors are deflated together; leaf colors repeat a
+    // lot in pruned trees, which deflate's back-references pick up
+    vector<unsigned char> payload, compressed;
+    payload.reserve(structure.size() + colors.size());
+    payload.insert(payload.end(), structure.begin(), structure.end());
+    payload.insert(payload.end(), colors.begin(), colors.end());
+    if (lodepng::compress(compressed, payload) != 0) return false;
+
+    writeHeader(out, TTREE_DEFLATE_HEADER_SIZE, TTREE_DEFLATE, width, height);
+    put32(&out[13], colors.size() / 4);
+    put32(&out[17], structure.size());
+    out.insert(out.end(), compressed.begin(), compressed.end());
+    return true;
+}
+
+bool TripleTree::SerializeTiled(vector<unsigned char>& out, unsigned int tileDepth) const {
+    if (root && (root->upperleft.first != 0 || root->upperleft.second != 0)) return false;
+    unsigned int width = root ? root->width : 0;
+    unsigned int height = root ? root->height : 0;
+
+    // Stream 0 is the top of the tree, stream i > 0 the subtree below tile i - 1
+    vector<vector<unsigned char>> streams(1);
+    deque<TreeCoder::Pending<const Node>> tiles;
+    if (root) {
+        TreeCoder coder;
+        RangeEncoder encoder(streams[0]);
+        if (!coder.encodeTop(root, tileDepth, tiles, encoder)) return false;
+        encoder.finish();
+
+        streams.resize(tiles.size() + 1);
+        for (size_t i = 0; i < tiles.size(); i++) {
+            TreeCoder tileCoder(coder);
+            RangeEncoder tileEncoder(streams[i + 1]);
+            if (!tileCoder.encodeTile(tiles[i], tileEncoder)) return false;
+            tileEncoder.finish();
+        }
+    }
+
+    writeHeader(out, TTREE_TILED_HEADER_SIZE, TTREE_TILED, width, height);
+    put32(&out[13], tileDepth);
+    put32(&out[17], tiles.size());
+
+    size_t indexAt = out.size();
+    uint64_t offset = indexAt + 8 * (streams.size() + 1);
+    out.resize(offset);
+    for (size_t i = 0; i < streams.size(); i++) {
+        put64(&out[indexAt + 8 * i], offset);
+        offset += streams[i].size();
+    }
+    put64(&out[indexAt + 8 * streams.size()], offset);
+    for (size_t i = 0; i < streams.size(); i++) {
+        out.insert(out.end(), streams[i].begin(), streams[i].end());
+    }
+    return true;
+}
+
+bool TripleTree::Serialize(const string& fileName, TreeEncoding encoding) const {
+    vector<unsigned char> bytes;
+    if (!Serialize(bytes, encoding)) {
+        cerr << "TripleTree: " << fileName << ": tree does not follow the split rule" << endl;
+        return false;
+    }
+
+    ofstream file(fileName.c_str(), ios::out | ios::binary);
+    file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    if (!file) {
+        cerr << "TripleTree: failed to write " << fileName << endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Rebuilds the node covering the given rectangle, or returns nullptr (with
+ * nothing allocated) if the data runs out or contradicts the geometry.
+ */
+Node* TripleTree::deserializeNode(pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h,
+                                  const unsigned char* structure, size_t structureBits, size_t& bit,
+                                  const unsigned char*& colors, const unsigned char* colorsEnd) {
+    bool internal = false;
+    if (w > 1 || h > 1) {
+        if (bit >= structureBits) return nullptr;
+        internal = (structure[bit >> 3] >> (bit & 7)) & 1;
+        bit++;
+    }
+
+    if (!internal) {
+        if (colorsEnd - colors < 4) return nullptr;
+        Node* node = new Node(ul, w, h);
+        Color8 color = {{ colors[0], colors[1], colors[2], colors[3] }};
+        node->avg = pixelOf(color);
+        colors += 4;
+        return node;
+    }
+
+    bool tall = w < h;
+    if (w == h) {
+        if (bit >= structureBits) return nullptr;
+        tall = (structure[bit >> 3] >> (bit & 7)) & 1;
+        bit++;
+    }
+
+    unsigned int partA, partB;
+    splitLengths(tall ? h : w, partA, partB);
+
+    Node* node = new Node(ul, w, h);
+    if (tall) {
+        node->A = deserializeNode(ul, w, partA, structure, structureBits, bit, colors, colorsEnd);
+        if (node->A && partB > 0)
+            node->B = deserializeNode({ul.first, ul.second + partA}, w, partB,
+                                      structure, structureBits, bit, colors, colorsEnd);
+        if (node->A && (node->B || partB == 0))
+            node->C = deserializeNode({ul.first, ul.second + partA + partB}, w, partA,
+                                      structure, structureBits, bit, colors, colorsEnd);
+    } else {
+        node->A = deserializeNode(ul, partA, h, structure, structureBits, bit, colors, colorsEnd);
+        if (node->A && partB > 0)
+            node->B = deserializeNode({ul.first + partA, ul.second}, partB, h,
+                                      structure, structureBits, bit, colors, colorsEnd);
+        if (node->A && (node->B || partB == 0))
+            node->C = deserializeNode({ul.first + partA + partB, ul.second}, partA, h,
+                                      structure, structureBits, bit, colors, colorsEnd);
+    }
+
+    if (!node->C) {
+        clearNode(node);
+        return nullptr;
+    }
+    return node;
+}
+
+/*
+ * Gives every internal node the average of its children, bottom up.
+ */
+void TripleTree::averageSubtree(Node* node) {
+    if (!node || isLeaf(node)) return;
+    averageSubtree(node->A);
+    averageSubtree(node->B);
+    averageSubtree(node->C);
+    computeAvgColor(node);
+}
+
+bool TripleTree::Deserialize(const unsigned char* data, size_t size) {
+    if (size < TTREE_HEADER_SIZE || memcmp(data, TTREE_MAGIC, sizeof(TTREE_MAGIC)) != 0) {
+        return false;
+    }
+
+    unsigned int width = get32(&data[5]);
+    unsigned int height = get32(&data[9]);
+    Node* tree = nullptr;
+
+    if (data[4] == TTREE_RANGE_CODED || data[4] == TTREE_PROGRESSIVE) {
+        if (width > 0 && height > 0) {
+            TreeCoder coder;
+            RangeDecoder decoder(data + TTREE_HEADER_SIZE, size - TTREE_HEADER_SIZE);
+            bool complete;
+            tree = coder.decode(width, height, data[4] == TTREE_PROGRESSIVE, decoder, complete);
+            if (!complete) {
+                clearNode(tree);
+                return false;
+            }
+        } else if (size != TTREE_HEADER_SIZE) {
+            return false;
+        }
+    } else if (data[4] == TTREE_TILED) {
+        if (!deserializeTiled(data, size, 0, 0, width, height, tree)) return false;
+    } else if (data[4] == TTREE_DEFLATE) {
+        if (size < TTREE_DEFLATE_HEADER_SIZE) return false;
+        size_t leaves = get32(&data[13]);
+        size_t structureSize = get32(&data[17]);
+
+        vector<unsigned char> payload;
+        if (lodepng::decompress(payload, data + TTREE_DEFLATE_HEADER_SIZE, size - TTREE_DEFLATE_HEADER_SIZE) != 0 ||
+            payload.size() < structureSize || (payload.size() - structureSize) != 4 * leaves) {
+            return false;
+        }
+
+        const unsigned char* structure = payload.data();
+        const unsigned char* colors = structure + structureSize;
+        const unsigned char* colorsEnd = structure + payload.size();
+        size_t bit = 0;
+
+        if (width > 0 && height > 0) {
+            tree = deserializeNode({0, 0}, width, height, structure, structureSize * 8, bit, colors, colorsEnd);
+            if (!tree) return false;
+        }
+
+        // Every stored bit and color must have been used
+        if (colors != colorsEnd || (bit + 7) / 8 != structureSize) {
+            clearNode(tree);
+            return false;
+        }
+        averageSubtree(tree);
+    } else {
+        return false;
+    }
+
+    Clear();
+    root = tree;
+    return true;
+}
+
+/*
+ * Decodes a TTREE_TILED encoding into tree, expanding only the tiles that
+ * intersect the rectangle [x0, x1) x [y0, y1); the rest stay leaves. Tiles
+ * are independent, so they are decoded on as many threads as there are
+ * cores. Returns false, with nothing allocated, if the data is invalid.
+ */
+bool TripleTree::deserializeTiled(const unsigned char* data, size_t size, unsigned int x0, unsigned int y0,
+                                  unsigned int x1, unsigned int y1, Node*& tree) {
+    tree = nullptr;
+    if (size < TTREE_TILED_HEADER_SIZE) return false;
+    unsigned int width = get32(&data[5]);
+    unsigned int height = get32(&data[9]);
+    unsigned int tileDepth = get32(&data[13]);
+    size_t tileCount = get32(&data[17]);
+
+    // Stream boundaries must be in order and cover the rest of the file exactly
+    size_t streamCount = tileCount + 1;
+    if ((size - TTREE_TILED_HEADER_SIZE) / 8 < streamCount + 1) return false;
+    const unsigned char* index = data + TTREE_TILED_HEADER_SIZE;
+    if (get64(index) != TTREE_TILED_HEADER_SIZE + 8 * (streamCount + 1) || get64(index + 8 * streamCount) != size) {
+        return false;
+    }
+    for (size_t i = 0; i < streamCount; i++) {
+        if (get64(index + 8 * i) > get64(index + 8 * (i + 1))) return false;
+    }
+
+    if (width == 0 || height == 0) return tileCount == 0 && get64(index + 8) == get64(index);
+
+    deque<TreeCoder::Pending<Node>> tiles;
+    TreeCoder topCoder;
+    {
+        RangeDecoder decoder(data + get64(index), get64(index + 8) - get64(index));
+        tree = topCoder.decodeTop(width, height, tileDepth, tiles, decoder);
+    }
+    if (!tree || tiles.size() != tileCount) {
+        clearNode(tree);
+        return false;
+    }
+
+    vector<size_t> wanted;
+    for (size_t i = 0; i < tiles.size(); i++) {
+        const Node* node = tiles[i].node;
+        if (node->upperleft.first < x1 && node->upperleft.first + node->width > x0 &&
+            node->upperleft.second < y1 && node->upperleft.second + node->height > y0) {
+            wanted.push_back(i);
+        }
+    }
+
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    auto work = [&]() {
+        for (size_t k = next++; k < wanted.size() && !failed; k = next++) {
+            size_t i = wanted[k];
+            uint64_t begin = get64(index + 8 * (i + 1));
+            TreeCoder coder(topCoder);
+            RangeDecoder decoder(data + begin, get64(index + 8 * (i + 2)) - begin);
+            if (!coder.decodeTile(tiles[i], decoder)) failed = true;
+        }
+    };
+
+    size_t threads = std::min<size_t>(std::max(thread::hardware_concurrency(), 1u), wanted.size());
+    vector<thread> workers;
+    for (size_t t = 1; t < threads; t++) {
+        workers.emplace_back(work);
+    }
+    work();
+    for (thread& worker : workers) {
+        worker.join();
+    }
+
+    if (failed) clearNode(tree);
+    return !failed;
+}
+
+bool TripleTree::DeserializeRegion(const unsigned char* data, size_t size, unsigned int x, unsigned int y,
+                                   unsigned int width, unsigned int height) {
+    if (size < TTREE_HEADER_SIZE || memcmp(data, TTREE_MAGIC, sizeof(TTREE_MAGIC)) != 0 ||
+        data[4] != TTREE_TILED) {
+        return Deserialize(data, size);
+    }
+
+    Node* tree;
+    unsigned int x1 = x + std::min(width, UINT_MAX - x);
+    unsigned int y1 = y + std::min(height, UINT_MAX - y);
+    if (!deserializeTiled(data, size, x, y, x1, y1, tree)) return false;
+    Clear();
+    root = tree;
+    return true;
+}
+
+bool TripleTree::DeserializeRegion(const string& fileName, unsigned int x, unsigned int y,
+                                   unsigned int width, unsigned int height) {
+    MappedFile file;
+    // Only the index and some tiles are read, so don't ask for read-ahead
+    if (!file.open(fileName, false)) {
+        cerr << "TripleTree: failed to open " << fileName << endl;
+        return false;
+    }
+    if (!DeserializeRegion(file.data(), file.size(), x, y, width, height)) {
+        cerr << "TripleTree: " << fileName << " is not a valid .ttree file" << endl;
+        return false;
+    }
+    return true;
+}
+
+bool TripleTree::DeserializePrefix(const unsigned char* data, size_t size, bool& complete) {
+    complete = false;
+    if (size < TTREE_HEADER_SIZE || memcmp(data, TTREE_MAGIC, sizeof(TTREE_MAGIC)) != 0 ||
+        data[4] != TTREE_PROGRESSIVE) {
+        complete = Deserialize(data, size);
+        return complete;
+    }
+
+    unsigned int width = get32(&data[5]);
+    unsigned int height = get32(&data[9]);
+    Node* tree = nullptr;
+    if (width > 0 && height > 0) {
+        TreeCoder coder;
+        RangeDecoder decoder(data + TTREE_HEADER_SIZE, size - TTREE_HEADER_SIZE);
+        tree = coder.decode(width, height, true, decoder, complete);
+        if (!tree) return false;
+    } else {
+        complete = true;
+    }
+
+    Clear();
+    root = tree;
+    return true;
+}
+
+bool TripleTree::Deserialize(const string& fileName) {
+    MappedFile file;
+    if (!file.open(fileName)) {
+        cerr << "TripleTree: failed to open " << fileName << endl;
+        return false;
+    }
+    if (!Deserialize(file.data(), file.size())) {
+        cerr << "TripleTree: " << fileName << " is not a valid .ttree file" << endl;
+        return false;
+    }
+    return true;
+}
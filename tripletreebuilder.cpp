@@ -0,0 +1,125 @@
+/**
+ * @file        tripletreebuilder.cpp
+ * @description Incremental construction of a TripleTree from scanlines.
+ */
+
+#include "tripletreebuilder.h"
+
+#include <algorithm>
+
+const unsigned int TripleTreeBuilder::DEFAULT_WINDOW;
+
+TripleTreeBuilder::TripleTreeBuilder(unsigned int window)
+    : window(std::max(window, 1u)), width(0), height(0),
+      rowsAdded(0), nextBand(0), firstRow(0) {
+}
+
+void TripleTreeBuilder::Begin(unsigned int width, unsigned int height) {
+    tree.Clear();
+    this->width = width;
+    this->height = height;
+    rowsAdded = 0;
+    firstRow = 0;
+    nextBand = 0;
+    ancestors.clear();
+    bands.clear();
+
+    planNode(&tree.root, {0, 0}, width, height);
+
+    // Bands are planned in preorder; build them in the order their rows complete
+    std::stable_sort(bands.begin(), bands.end(), [](const Band& a, const Band& b) {
+        return a.y + a.h < b.y + b.h;
+    });
+
+    rows.assign((size_t) width * std::min(height, 2 * window), RGBAPixel());
+    if (bands.empty()) finishTree();
+}
+
+/*
+ * Creates the nodes taller than the window, splitting exactly like
+ * BuildNode, and records the subtrees below them as bands.
+ */
+void TripleTreeBuilder::planNode(Node** slot, pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h) {
+    if ((w == 0) || (h == 0)) {
+        *slot = nullptr;
+        return;
+    }
+    if (h <= window) {
+        *slot = nullptr;
+        bands.push_back({slot, ul.first, ul.second, w, h});
+        return;
+    }
+
+    Node* node = new Node(ul, w, h);
+    *slot = node;
+    ancestors.push_back(node);
+
+    unsigned int partA, partB;
+    TripleTree::splitLengths((w > h) ? w : h, partA, partB);
+
+    if (w < h) {
+        planNode(&node->A, ul, w, partA);
+        planNode(&node->B, {ul.first, ul.second + partA}, w, partB);
+        planNode(&node->C, {ul.first, ul.second + partA + partB}, w, partA);
+    } else {
+        planNode(&node->A, ul, partA, h);
+        planNode(&node->B, {ul.first + partA, ul.second}, partB, h);
+        planNode(&node->C, {ul.first + partA + partB, ul.second}, partA, h);
+    }
+}
+
+RGBAPixel* TripleTreeBuilder::windowRow(unsigned int y) {
+    return rows.data() + (size_t) (y - firstRow) * width;
+}
+
+void TripleTreeBuilder::AddRow(const RGBAPixel* row) {
+    if (rowsAdded >= height) return;
+    if (width == 0) {
+        rowsAdded++;
+        return;
+    }
+
+    // When the buffer is full, keep only the rows a pending band can still need
+    if ((size_t) (rowsAdded - firstRow) * width == rows.size()) {
+        unsigned int keep = window - 1;
+        std::copy(windowRow(rowsAdded - keep), windowRow(rowsAdded), rows.data());
+        firstRow = rowsAdded - keep;
+    }
+
+    std::copy(row, row + width, windowRow(rowsAdded));
+    rowsAdded++;
+
+    while (nextBand < bands.size() && bands[nextBand].y + bands[nextBand].h == rowsAdded) {
+        const Band& band = bands[nextBand++];
+        ImageView view(windowRow(band.y), width, band.h, width);
+        *band.slot = tree.BuildNode(view, {band.x, band.y}, band.w, band.h, band.y);
+    }
+
+    if (rowsAdded == height) finishTree();
+}
+
+/*
+ * Every band is built; average the ancestors bottom up (children come
+ * after their parents in preorder) and release the window.
+ */
+void TripleTreeBuilder::finishTree() {
+    for (size_t i = ancestors.size(); i > 0; i--) {
+        tree.computeAvgColor(ancestors[i - 1]);
+    }
+    ancestors.clear();
+    bands.clear();
+    vector<RGBAPixel>().swap(rows);
+}
+
+bool TripleTreeBuilder::ReadFromFile(const string& fileName) {
+    bool ok = PNG::readRows(fileName, [this](unsigned int y, const RGBAPixel* row,
+                                             unsigned int w, unsigned int h) {
+        if (y == 0) Begin(w, h);
+        AddRow(row);
+    });
+    return ok && Complete();
+}
+
+bool TripleTreeBuilder::Complete() const {
+    return rowsAdded == height;
+}
@@ -0,0 +1,107 @@
+/**
+ * @file        tripletreebuilder.h
+ * @description Incremental construction of a TripleTree from scanlines,
+ *              so large images never have to be held in memory whole.
+ */
+
+#ifndef _TRIPLETREEBUILDER_H_
+#define _TRIPLETREEBUILDER_H_
+
+#include <string>
+#include <vector>
+
+#include "tripletree.h"
+
+/**
+ * Builds a TripleTree while its image arrives one row at a time, top to
+ * bottom, e.g. straight out of the PNG decoder.
+ *
+ * Nodes taller than the row window are split up front, following the same
+ * rules as TripleTree(PNG&): a tall split stacks its children, and a wide
+ * split puts them side by side over the same rows. This ends in a set of
+ * bands, subtrees at most window rows tall, that tile the image. A band is
+ * built as soon as its last row has been added, and the ancestors above the
+ * bands get their averages once every band is done. Any band still waiting
+ * for rows starts at most window - 1 rows above the newest row, so only the
+ * last 2 * window rows are ever buffered: peak memory is the tree plus that
+ * window, not the tree plus the image.
+ *
+ * The finished tree is identical to the one built from the whole image.
+ */
+class TripleTreeBuilder {
+public:
+    /* Default number of rows in the window */
+    static const unsigned int DEFAULT_WINDOW = 64;
+
+    /**
+     * Creates a builder with no image; Begin or ReadFromFile starts one.
+     *
+     * @param window - maximum height of a band, in rows (at least 1)
+     */
+    TripleTreeBuilder(unsigned int window = DEFAULT_WINDOW);
+
+    /* Bands point into the tree under construction, so builders are not copied */
+    TripleTreeBuilder(const TripleTreeBuilder&) = delete;
+    TripleTreeBuilder& operator=(const TripleTreeBuilder&) = delete;
+
+    /**
+     * Starts building the tree of a width x height image, discarding
+     * anything built before.
+     *
+     * @param width - width of the image
+     * @param height - height of the image
+     */
+    void Begin(unsigned int width, unsigned int height);
+
+    /**
+     * Adds the next row of the image and builds every band it completes.
+     * Rows beyond the image height are ignored.
+     *
+     * @param row - pointer to the width pixels of the row
+     */
+    void AddRow(const RGBAPixel* row);
+
+    /**
+     * Decodes a PNG file row by row and builds its tree, without ever
+     * holding the decoded image.
+     *
+     * @param fileName - name of the PNG file
+     * @return true if the file was decoded and the tree is complete
+     */
+    bool ReadFromFile(const string& fileName);
+
+    /*
+     * Returns whether every row has been added, i.e. whether the tree is
+     * ready to be taken by TripleTree(TripleTreeBuilder&).
+     */
+    bool Complete() const;
+
+private:
+    friend class TripleTree;
+
+    /* A subtree small enough to be built from the row window */
+    struct Band {
+        Node** slot;      // where the finished subtree goes
+        unsigned int x;   // upper left corner
+        unsigned int y;
+        unsigned int w;   // dimensions
+        unsigned int h;
+    };
+
+    void planNode(Node** slot, pair<unsigned int, unsigned int> ul, unsigned int w, unsigned int h);
+    RGBAPixel* windowRow(unsigned int y);
+    void finishTree();
+
+    TripleTree tree;             // tree under construction; owns all nodes built so far
+    unsigned int window;         // maximum band height
+    unsigned int width;          // image dimensions
+    unsigned int height;
+    unsigned int rowsAdded;      // rows received so far
+    vector<Node*> ancestors;     // nodes above the bands, in preorder
+    vector<Band> bands;          // bands ordered by their last row
+    size_t nextBand;             // first band not yet built
+    vector<RGBAPixel> rows;      // buffered rows [firstRow, rowsAdded)
+    unsigned int firstRow;
+};
+
+#endif
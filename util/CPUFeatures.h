@@ -0,0 +1,30 @@
+/**
+ * @file CPUFeatures.h
+ * Runtime checks for optional instruction set extensions, used to pick
+ * vectorized kernels with a scalar fallback.
+ */
+
+#ifndef CS221_CPUFEATURES_H_
+#define CS221_CPUFEATURES_H_
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CS221_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace cs221util {
+  /**
+   * @return Whether AVX2 kernels may be used on this CPU. Always false
+   * on compilers or targets without x86 function multiversioning.
+   */
+  inline bool cpuHasAVX2() {
+#ifdef CS221_X86_DISPATCH
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+  }
+}
+
+#endif
@@ -0,0 +1,112 @@
+/**
+ * @file ContentHash.cpp
+ * Implementation of the streaming image content hash.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include "ContentHash.h"
+
+namespace cs221util {
+  namespace {
+    // Odd constants with well-mixed bits (the wyhash secret)
+    const uint64_t P0 = 0xa0761d6478bd642full;
+    const uint64_t P1 = 0xe7037ed1a0b428dbull;
+    const uint64_t P2 = 0x8ebc6af09c88c6e3ull;
+    const uint64_t P3 = 0x589965cc75374cc3ull;
+
+#if defined(__SIZEOF_INT128__)
+    __extension__ typedef unsigned __int128 uint128;
+#endif
+
+    // Multiplies a and b to 128 bits and folds the halves together
+    inline uint64_t mix(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+      uint128 product = (uint128) a * b;
+      return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+      uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t) a, lb = (uint32_t) b;
+      uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+      uint64_t t = rl + (rm0 << 32);
+      uint64_t carry = t < rl;
+      uint64_t lo = t + (rm1 << 32);
+      carry += lo < t;
+      uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + carry;
+      return lo ^ hi;
+#endif
+    }
+
+    // Little-endian load, independent of host byte order and alignment
+    inline uint64_t read64(const unsigned char * p) {
+      return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24 |
+             (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+    }
+
+    inline uint64_t block(uint64_t state, const unsigned char * p) {
+      return mix(read64(p) ^ P1, read64(p + 8) ^ state);
+    }
+  }
+
+  ContentHasher::ContentHasher(uint64_t seed) {
+    state_ = seed ^ mix(seed ^ P0, P1);
+    length_ = 0;
+    buffered_ = 0;
+  }
+
+  void ContentHasher::update(const unsigned char * data, size_t length) {
+    length_ += length;
+
+    if (buffered_ > 0) {
+      size_t take = std::min(length, sizeof(buffer_) - buffered_);
+      memcpy(buffer_ + buffered_, data, take);
+      buffered_ += take;
+      data += take;
+      length -= take;
+      if (buffered_ < sizeof(buffer_)) { return; }
+      state_ = block(state_, buffer_);
+      buffered_ = 0;
+    }
+
+    uint64_t state = state_;
+    for (; length >= 16; data += 16, length -= 16) {
+      state = block(state, data);
+    }
+    state_ = state;
+
+    memcpy(buffer_, data, length);
+    buffered_ = length;
+  }
+
+  void ContentHasher::updateDimensions(unsigned int width, unsigned int height) {
+    unsigned char bytes[8];
+    for (unsigned int i = 0; i < 4; i++) {
+      bytes[i] = (unsigned char) (width >> (8 * i));
+      bytes[i + 4] = (unsigned char) (height >> (8 * i));
+    }
+    update(bytes, sizeof(bytes));
+  }
+
+  void ContentHasher::updateRow(const RGBAPixel * row, unsigned int width) {
+    // Convert in chunks so the hash sees whole blocks without a row-sized buffer
+    unsigned char bytes[256];
+    while (width > 0) {
+      unsigned int n = std::min(width, (unsigned int) (sizeof(bytes) / 4));
+      for (unsigned int i = 0; i < n; i++) {
+        bytes[(i * 4)]     = row[i].r;
+        bytes[(i * 4) + 1] = row[i].g;
+        bytes[(i * 4) + 2] = row[i].b;
+        bytes[(i * 4) + 3] = row[i].a * 255;
+      }
+      update(bytes, n * 4);
+      row += n;
+      width -= n;
+    }
+  }
+
+  uint64_t ContentHasher::digest() const {
+    unsigned char tail[16] = { 0 };
+    memcpy(tail, buffer_, buffered_);
+    uint64_t state = buffered_ > 0 ? block(state_, tail) : state_;
+    return mix(state ^ P2, length_ ^ P3);
+  }
+}
@@ -0,0 +1,72 @@
+/**
+ * @file ContentHash.h
+ * Streaming 64-bit content hash for images, suitable for keying result
+ * caches and de-duplicating inputs.
+ */
+
+#ifndef CS221_CONTENTHASH_H_
+#define CS221_CONTENTHASH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include "RGBAPixel.h"
+
+namespace cs221util {
+  /**
+   * Incremental 64-bit hash in the style of wyhash. Input is consumed in
+   * 16-byte blocks, each folded into the state with one 64x64->128 bit
+   * multiply; partial blocks are buffered between calls, so feeding the
+   * same bytes in any chunking gives the same result.
+   *
+   * Images are hashed as their dimensions followed by their rows,
+   * row-major over their RGBA8 encoding (4 bytes per pixel, alpha scaled
+   * to [0, 255] exactly as PNG::writeToFile does), so the hash of a
+   * decoded file can be computed while its rows arrive.
+   */
+  class ContentHasher {
+  public:
+    /**
+     * Starts a new hash.
+     * @param seed Seed mixed into the initial state.
+     */
+    explicit ContentHasher(uint64_t seed = 0);
+
+    /**
+     * Feeds raw bytes to the hash.
+     * @param data Bytes to be hashed.
+     * @param length Number of bytes.
+     */
+    void update(const unsigned char * data, size_t length);
+
+    /**
+     * Feeds an image's dimensions to the hash, as 32-bit little-endian
+     * width and height. Fed ahead of the rows, they keep images with the
+     * same bytes in different shapes (4x1 and 2x2, say) apart.
+     * @param width Width of the image.
+     * @param height Height of the image.
+     */
+    void updateDimensions(unsigned int width, unsigned int height);
+
+    /**
+     * Feeds one row of pixels to the hash, as its RGBA8 encoding.
+     * @param row Pointer to the first pixel of the row.
+     * @param width Number of pixels in the row.
+     */
+    void updateRow(const RGBAPixel * row, unsigned int width);
+
+    /**
+     * Gets the hash of everything fed so far. Does not change the state,
+     * so more data may be added afterwards.
+     * @return The 64-bit hash.
+     */
+    uint64_t digest() const;
+
+  private:
+    uint64_t state_;              /*< Running hash state */
+    uint64_t length_;             /*< Total number of bytes fed */
+    unsigned char buffer_[16];    /*< Pending bytes of an incomplete block */
+    size_t buffered_;             /*< Number of valid bytes in buffer_ */
+  };
+}
+
+#endif
@@ -0,0 +1,101 @@
+/**
+ * @file ImageView.h
+ * Non-owning view of a rectangle of pixels inside a PNG.
+ */
+
+#ifndef CS221_IMAGEVIEW_H_
+#define CS221_IMAGEVIEW_H_
+
+#include <algorithm>
+#include <cstddef>
+#include "PNG.h"
+#include "RGBAPixel.h"
+
+namespace cs221util {
+  /**
+   * A width x height window onto pixels owned by someone else, usually a
+   * PNG. Pixel (x, y) of the view lives at data()[x + y * stride()].
+   * Views never copy or free pixels, so the underlying image must outlive
+   * them and must not be resized while they are in use.
+   */
+  class ImageView {
+  public:
+    /**
+     * Creates an empty view.
+     */
+    ImageView() : data_(NULL), width_(0), height_(0), stride_(0) { }
+
+    /**
+     * Creates a view of raw pixel memory.
+     * @param data Pointer to the upper left pixel.
+     * @param width Width of the view.
+     * @param height Height of the view.
+     * @param stride Distance, in pixels, between the starts of two rows.
+     */
+    ImageView(RGBAPixel * data, unsigned int width, unsigned int height, unsigned int stride)
+      : data_(data), width_(width), height_(height), stride_(stride) { }
+
+    /**
+     * Creates a view of a whole image.
+     * @param png Image to be viewed.
+     */
+    ImageView(PNG const & png)
+      : data_(png.data()), width_(png.width()), height_(png.height()), stride_(png.stride()) { }
+
+    /**
+     * Creates a view of the rectangle of png with upper left corner (x, y).
+     * The rectangle is cropped to the image, so views that start or reach
+     * past its edges are smaller than requested (or empty).
+     * @param png Image to be viewed.
+     * @param x X-coordinate of the upper left corner.
+     * @param y Y-coordinate of the upper left corner.
+     * @param width Requested width of the view.
+     * @param height Requested height of the view.
+     */
+    ImageView(PNG const & png, unsigned int x, unsigned int y, unsigned int width, unsigned int height) {
+      *this = ImageView(png).subview(x, y, width, height);
+    }
+
+    /**
+     * Gets a view of a rectangle of this view, cropped to this view.
+     * @param x X-coordinate of the upper left corner, relative to this view.
+     * @param y Y-coordinate of the upper left corner, relative to this view.
+     * @param width Requested width of the subview.
+     * @param height Requested height of the subview.
+     * @return The subview; no pixels are copied.
+     */
+    ImageView subview(unsigned int x, unsigned int y, unsigned int width, unsigned int height) const {
+      if (x >= width_ || y >= height_) { return ImageView(); }
+      width = std::min(width, width_ - x);
+      height = std::min(height, height_ - y);
+      return ImageView(row(y) + x, width, height, stride_);
+    }
+
+    /**
+     * Unchecked row access; y must be in [0, height()).
+     * @param y Row of the view.
+     * @return A pointer to pixel (0, y) of the view.
+     */
+    RGBAPixel * row(unsigned int y) const { return data_ + (size_t) y * stride_; }
+
+    /** @return A pointer to the upper left pixel of the view. */
+    RGBAPixel * data() const { return data_; }
+
+    /** @return Width of the view in pixels. */
+    unsigned int width() const { return width_; }
+
+    /** @return Height of the view in pixels. */
+    unsigned int height() const { return height_; }
+
+    /** @return Distance, in pixels, between the starts of two rows. */
+    unsigned int stride() const { return stride_; }
+
+  private:
+    RGBAPixel * data_;      /*< Upper left pixel of the view */
+    unsigned int width_;    /*< Width of the view */
+    unsigned int height_;   /*< Height of the view */
+    unsigned int stride_;   /*< Row stride of the underlying image */
+  };
+}
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file MappedFile.cpp
+ * Implementation of read-only file mappings.
+ */
+
+#include "MappedFile.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CS221_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fstream>
+#include <iterator>
+#endif
+
+namespace cs221util {
+  MappedFile::MappedFile() {
+    data_ = NULL;
+    size_ = 0;
+  }
+
+  MappedFile::~MappedFile() {
+    close();
+  }
+
+#ifdef CS221_HAVE_MMAP
+  bool MappedFile::open(std::string const & fileName, bool sequential) {
+    close();
+
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+      ::close(fd);
+      return false;
+    }
+
+    // mmap rejects zero-length mappings; an empty file is simply empty
+    if (info.st_size > 0) {
+      void * mapped = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped == MAP_FAILED) {
+        ::close(fd);
+        return false;
+      }
+      if (sequential) { madvise(mapped, (size_t) info.st_size, MADV_SEQUENTIAL); }
+      data_ = static_cast<const unsigned char *>(mapped);
+      size_ = (size_t) info.st_size;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    ::close(fd);
+    return true;
+  }
+
+  void MappedFile::close() {
+    if (data_ != NULL) { munmap(const_cast<unsigned char *>(data_), size_); }
+    data_ = NULL;
+    size_ = 0;
+  }
+#else
+  bool MappedFile::open(std::string const & fileName, bool) {
+    close();
+
+    std::ifstream file(fileName.c_str(), std::ios::binary);
+    if (!file) { return false; }
+    buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data_ = buffer_.empty() ? NULL : &buffer_[0];
+    size_ = buffer_.size();
+    return true;
+  }
+
+  void MappedFile::close() {
+    buffer_.clear();
+    data_ = NULL;
+    size_ = 0;
+  }
+#endif
+
+  const unsigned char * MappedFile::data() const {
+    return data_;
+  }
+
+  size_t MappedFile::size() const {
+    return size_;
+  }
+}
@@ -0,0 +1,68 @@
+/**
+ * @file MappedFile.h
+ * Read-only memory mapping of a whole file.
+ */
+
+#ifndef CS221_MAPPEDFILE_H_
+#define CS221_MAPPEDFILE_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace cs221util {
+  /**
+   * Maps a file into memory read-only, so it can be parsed in place
+   * without copying it into a heap buffer. The mapping is released when
+   * the object is destroyed. On platforms without mmap the file is read
+   * into an owned buffer instead, with the same interface.
+   */
+  class MappedFile {
+  public:
+    /**
+     * Creates an object with no file mapped.
+     */
+    MappedFile();
+
+    /**
+     * Unmaps the file, if any.
+     */
+    ~MappedFile();
+
+    /**
+     * Maps the given file, replacing any previous mapping.
+     * @param fileName Name of the file to be mapped.
+     * @param sequential Whether to advise the OS that the file will be read
+     * front to back (madvise(MADV_SEQUENTIAL)), favouring read-ahead.
+     * @return true, if the file was opened and mapped.
+     */
+    bool open(std::string const & fileName, bool sequential = true);
+
+    /**
+     * Unmaps the file, if any.
+     */
+    void close();
+
+    /**
+     * @return Pointer to the first byte of the file, or NULL if no file
+     * (or an empty file) is mapped.
+     */
+    const unsigned char * data() const;
+
+    /**
+     * @return Size of the mapped file in bytes.
+     */
+    size_t size() const;
+
+  private:
+    // Not copyable: the mapping has a single owner
+    MappedFile(MappedFile const & other);
+    MappedFile & operator=(MappedFile const & other);
+
+    const unsigned char * data_;        /*< Start of the mapping */
+    size_t size_;                       /*< Length of the mapping */
+    std::vector<unsigned char> buffer_; /*< Fallback storage without mmap */
+  };
+}
+
+#endif
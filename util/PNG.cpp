@@ -11,8 +11,14 @@
 #include <algorithm>
 #include <functional>
 #include <cassert>
+#include <cmath>
+#include <mutex>
+#include <new>
 #include "lodepng/lodepng.h"
 #include "PNG.h"
+#include "ContentHash.h"
+#include "CPUFeatures.h"
+#include "MappedFile.h"
 //#include "RGB_HSL.h"
 
 namespace cs221util {
@@ -72,6 +78,133 @@ namespace cs221util {
     return !(*this == other);
   }
 
+  namespace {
+    // Running totals of a comparison over a stretch of pixels
+    struct CompareState {
+      size_t mismatches;
+      size_t first;
+      unsigned int maxDelta;
+      double maxAlphaDelta;
+    };
+
+    inline unsigned int channelDelta(unsigned char x, unsigned char y) {
+      return x > y ? x - y : y - x;
+    }
+
+    inline bool pixelsMatch(RGBAPixel const & p, RGBAPixel const & q, bool tolerant) {
+      if (tolerant) { return p == q; }
+      return p.r == q.r && p.g == q.g && p.b == q.b && p.a == q.a;
+    }
+
+    void compareScalar(RGBAPixel const * p, RGBAPixel const * q, size_t begin, size_t end,
+                       bool tolerant, CompareState & state) {
+      for (size_t i = begin; i < end; i++) {
+        unsigned int delta = max(channelDelta(p[i].r, q[i].r),
+                                 max(channelDelta(p[i].g, q[i].g), channelDelta(p[i].b, q[i].b)));
+        state.maxDelta = max(state.maxDelta, delta);
+        state.maxAlphaDelta = max(state.maxAlphaDelta, fabs(p[i].a - q[i].a));
+        if (!pixelsMatch(p[i], q[i], tolerant)) {
+          if (state.mismatches == 0) { state.first = i; }
+          state.mismatches++;
+        }
+      }
+    }
+
+#ifdef CS221_X86_DISPATCH
+    /*
+     * Four pixels per step. An RGBAPixel is 16 bytes: r, g, b in bytes 0-2,
+     * padding, then the alpha double in bytes 8-15. Unpacking two 32-byte
+     * loads gathers the color words and the alphas of the four pixels into
+     * one register each (lane order 0, 2, 1, 3, which only matters when
+     * locating the first mismatch, done with the scalar code).
+     */
+    __attribute__((target("avx2")))
+    size_t compareAVX2(RGBAPixel const * p, RGBAPixel const * q, size_t count,
+                       bool tolerant, CompareState & state) {
+      const __m256i colorMask = _mm256_set1_epi64x(0xFFFFFF);
+      const __m256i slack = _mm256_set1_epi8(tolerant ? 2 : 0);
+      const __m256d signMask = _mm256_set1_pd(-0.0);
+      const __m256d alphaSlack = _mm256_set1_pd(0.01);
+      __m256i maxDelta = _mm256_setzero_si256();
+      __m256d maxAlphaDelta = _mm256_setzero_pd();
+
+      size_t i = 0;
+      for (; i + 4 <= count; i += 4) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i p1 = _mm256_loadu_si256((const __m256i *) (p + i + 2));
+        __m256i q0 = _mm256_loadu_si256((const __m256i *) (q + i));
+        __m256i q1 = _mm256_loadu_si256((const __m256i *) (q + i + 2));
+
+        __m256i pc = _mm256_unpacklo_epi64(p0, p1);
+        __m256i qc = _mm256_unpacklo_epi64(q0, q1);
+        __m256i delta = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(pc, qc), _mm256_subs_epu8(qc, pc)), colorMask);
+        maxDelta = _mm256_max_epu8(maxDelta, delta);
+        __m256i colorOff = _mm256_cmpeq_epi64(_mm256_subs_epu8(delta, slack), _mm256_setzero_si256());
+
+        __m256d pa = _mm256_castsi256_pd(_mm256_unpackhi_epi64(p0, p1));
+        __m256d qa = _mm256_castsi256_pd(_mm256_unpackhi_epi64(q0, q1));
+        __m256d alphaDelta = _mm256_andnot_pd(signMask, _mm256_sub_pd(pa, qa));
+        maxAlphaDelta = _mm256_max_pd(alphaDelta, maxAlphaDelta);
+
+        // colorOff lanes are all-ones where the colors match
+        __m256d match = _mm256_castsi256_pd(colorOff);
+        if (tolerant) {
+          match = _mm256_and_pd(match, _mm256_cmp_pd(alphaDelta, alphaSlack, _CMP_NGT_UQ));
+          match = _mm256_or_pd(match, _mm256_cmp_pd(pa, _mm256_setzero_pd(), _CMP_EQ_OQ));
+        } else {
+          match = _mm256_and_pd(match, _mm256_cmp_pd(pa, qa, _CMP_EQ_OQ));
+        }
+
+        int mismatched = ~_mm256_movemask_pd(match) & 0xF;
+        if (mismatched) {
+          if (state.mismatches == 0) {
+            CompareState block = { 0, 0, 0, 0 };
+            compareScalar(p, q, i, i + 4, tolerant, block);
+            state.first = block.first;
+          }
+          state.mismatches += __builtin_popcount(mismatched);
+        }
+      }
+
+      unsigned char deltas[32];
+      _mm256_storeu_si256((__m256i *) deltas, maxDelta);
+      for (unsigned char d : deltas) {
+        state.maxDelta = max(state.maxDelta, (unsigned int) d);
+      }
+      double alphaDeltas[4];
+      _mm256_storeu_pd(alphaDeltas, maxAlphaDelta);
+      for (double d : alphaDeltas) {
+        state.maxAlphaDelta = max(state.maxAlphaDelta, d);
+      }
+      return i;
+    }
+#endif
+  }
+
+  PNG::Comparison PNG::compare(PNG const & other, bool tolerant) const {
+    Comparison result = { false, false, 0, 0, 0, 0, 0 };
+    if (width_ != other.width_ || height_ != other.height_) { return result; }
+    result.sameSize = true;
+
+    size_t count = (size_t) width_ * height_;
+    CompareState state = { 0, 0, 0, 0 };
+    size_t i = 0;
+#ifdef CS221_X86_DISPATCH
+    if (cpuHasAVX2()) { i = compareAVX2(imageData_, other.imageData_, count, tolerant, state); }
+#endif
+    compareScalar(imageData_, other.imageData_, i, count, tolerant, state);
+
+    result.equal = (state.mismatches == 0);
+    result.mismatches = state.mismatches;
+    result.maxDelta = state.maxDelta;
+    result.maxAlphaDelta = state.maxAlphaDelta;
+    if (state.mismatches > 0) {
+      result.firstX = state.first % width_;
+      result.firstY = state.first / width_;
+    }
+    return result;
+  }
+
   RGBAPixel * PNG::getPixel(unsigned int x, unsigned int y) const {
     if (width_ == 0 || height_ == 0) {
       cerr << "ERROR: Call to cs225::PNG::getPixel() made on an image with no pixels." << endl;
@@ -97,48 +230,171 @@ namespace cs221util {
     return &imageData_[index];
   }
 
-  bool PNG::readFromFile(string const & fileName) {
-    vector<unsigned char> byteData;
-    unsigned error = lodepng::decode(byteData, width_, height_, fileName);
+  namespace {
+    // Alpha byte to [0, 1], the same values as byte/255. without a divide per pixel
+    struct AlphaTable {
+      double values[256];
+      AlphaTable() {
+        for (unsigned i = 0; i < 256; i++) { values[i] = i/255.; }
+      }
+    };
+    const AlphaTable alphaTable;
+
+    // Converts a row of RGBA8 bytes to pixels
+    void convertRow(const unsigned char * row, RGBAPixel * out, unsigned w) {
+      for (unsigned x = 0; x < w; x++, row += 4) {
+        RGBAPixel & pixel = out[x];
+        pixel.r = row[0];
+        pixel.g = row[1];
+        pixel.b = row[2];
+        pixel.a = alphaTable.values[row[3]];
+      }
+    }
 
-    if (error) {
-      cerr << "PNG decoder error " << error << ": " << lodepng_error_text(error) << endl;
-      return false;
+    // Destination of a row-by-row decode; pixels is allocated by whichever
+    // thread delivers the first row
+    struct DecodeTarget {
+      RGBAPixel * pixels;
+      std::once_flag allocated;
+    };
+
+    unsigned storeDecodedRow(void * user, unsigned y, const unsigned char * row, unsigned w, unsigned h) {
+      DecodeTarget * target = static_cast<DecodeTarget *>(user);
+      std::call_once(target->allocated, [target, w, h]() {
+        target->pixels = new (std::nothrow) RGBAPixel[(size_t) w * h];
+      });
+      if (target->pixels == NULL) { return 83; /* lodepng: memory allocation failed */ }
+      convertRow(row, target->pixels + (size_t) y * w, w);
+      return 0;
     }
 
-    delete[] imageData_;
-    imageData_ = new RGBAPixel[width_ * height_];
+    // Destination of PNG::readRows: one converted row, passed on to the handler
+    struct RowTarget {
+      PNG::RowHandler const * handler;
+      vector<RGBAPixel> row;
+    };
+
+    unsigned forwardDecodedRow(void * user, unsigned y, const unsigned char * row, unsigned w, unsigned h) {
+      RowTarget * target = static_cast<RowTarget *>(user);
+      target->row.resize(w);
+      convertRow(row, target->row.data(), w);
+      (*target->handler)(y, target->row.data(), w, h);
+      return 0;
+    }
+
+    // Decodes a file from a read-only mapping into RGBA8 rows for callback,
+    // reporting failures on cerr. If parallel, files with restart points
+    // are decoded on several threads, calling back in no particular order.
+    bool decodeRows(string const & fileName, LodePNGRowCallback callback, void * user,
+                    unsigned & width, unsigned & height, bool parallel) {
+      MappedFile file;
+      unsigned error = 78; /* lodepng: failed to open file for reading */
+      if (file.open(fileName)) {
+        lodepng::State state;
+        state.info_raw.colortype = LCT_RGBA;
+        state.info_raw.bitdepth = 8;
+        if (parallel) {
+          error = lodepng::decode_rows_parallel(width, height, state, file.data(), file.size(), callback, user);
+        } else {
+          error = lodepng_decode_rows(&width, &height, &state, file.data(), file.size(), callback, user);
+        }
+      }
 
-    for (unsigned i = 0; i < byteData.size(); i += 4) {
-      RGBAPixel & pixel = imageData_[i/4];
-      pixel.r = byteData[i];
-      pixel.g = byteData[i + 1];
-      pixel.b = byteData[i + 2];
-      pixel.a = byteData[i + 3]/255.;
+      if (error) {
+        cerr << "PNG decoder error " << error << ": " << lodepng_error_text(error) << endl;
+        return false;
+      }
+      return true;
+    }
+  }
 
+  bool PNG::readFromFile(string const & fileName) {
+    // Rows arrive one at a time as RGBA8 and are converted straight into
+    // the pixel array, so no full-size intermediate byte buffer exists.
+    // Each row has its own place in the array, so bands may arrive from
+    // several threads at once.
+    unsigned width = 0, height = 0;
+    DecodeTarget target;
+    target.pixels = NULL;
+    if (!decodeRows(fileName, storeDecodedRow, &target, width, height, true)) {
+      delete[] target.pixels;
+      return false;
     }
-/*
-    for (unsigned i = 0; i < byteData.size(); i += 4) {
-      rgbaColor rgb;
-      rgb.r = byteData[i];
-      rgb.g = byteData[i + 1];
-      rgb.b = byteData[i + 2];
-      rgb.a = byteData[i + 3];
-
-      hslaColor hsl = rgb2hsl(rgb);
-      RGBAPixel & pixel = imageData_[i/4];
-      pixel.h = hsl.h;
-      pixel.s = hsl.s;
-      pixel.l = hsl.l;
-      pixel.a = hsl.a;
-    }
-*/
+
+    delete[] imageData_;
+    imageData_ = target.pixels;
+    width_ = width;
+    height_ = height;
 
     return true;
   }
 
+  bool PNG::readRows(string const & fileName, RowHandler const & handler) {
+    unsigned width = 0, height = 0;
+    RowTarget target;
+    target.handler = &handler;
+    // The handler expects rows in order, from one thread
+    return decodeRows(fileName, forwardDecodedRow, &target, width, height, false);
+  }
+
+  namespace {
+    // Scanline bytes per band between ENCODE_FASTEST's restart points:
+    // enough that the 512-byte window loses next to nothing at each one
+    const size_t RESTART_BAND_BYTES = 256 * 1024;
+
+    /*
+     * Settings for encoding with a preset: LZ77 effort and the filter strategy
+     * of one attempt (ENCODE_SMALLEST makes several). Returns false once there
+     * are no attempts left.
+     */
+    bool encoderSettings(PNG::EncodePreset preset, unsigned attempt, unsigned width, bool opaque,
+                         vector<unsigned char> & upFilters, LodePNGEncoderSettings & encoder,
+                         LodePNGColorMode & color) {
+      LodePNGCompressSettings & zlib = encoder.zlibsettings;
+      switch (preset) {
+        case PNG::ENCODE_FASTEST:
+          if (attempt > 0) { return false; }
+          // Up suits rendered trees, whose leaves repeat pixels down their rows
+          zlib.windowsize = 512;
+          zlib.nicematch = 32;
+          zlib.lazymatching = 0;
+          encoder.filter_strategy = LFS_PREDEFINED;
+          encoder.predefined_filters = upFilters.data();
+          encoder.filter_palette_zero = 0;
+          encoder.auto_convert = 0;
+          color.colortype = opaque ? LCT_RGB : LCT_RGBA;
+          color.bitdepth = 8;
+          // Restart points let readFromFile decode large images on several threads
+          encoder.restart_rows = max<size_t>(RESTART_BAND_BYTES / ((size_t) width * (opaque ? 3 : 4) + 1), 1);
+          return true;
+
+        case PNG::ENCODE_BALANCED:
+          return attempt == 0;
+
+        case PNG::ENCODE_SMALLEST: {
+          // The defaults first, so the result is never larger than ENCODE_BALANCED's.
+          // Unfiltered rows win on large flat areas, which the heuristics miss.
+          static const LodePNGFilterStrategy strategies[] = { LFS_ZERO, LFS_PREDEFINED, LFS_MINSUM, LFS_ENTROPY };
+          if (attempt == 0) { return true; }
+          if (attempt > sizeof(strategies) / sizeof(strategies[0])) { return false; }
+          zlib.windowsize = 32768;
+          zlib.nicematch = 258;
+          encoder.filter_strategy = strategies[attempt - 1];
+          encoder.predefined_filters = upFilters.data();
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+
   bool PNG::writeToFile(string const & fileName) {
+    return writeToFile(fileName, ENCODE_BALANCED);
+  }
+
+  bool PNG::writeToFile(string const & fileName, EncodePreset preset) {
     unsigned char *byteData = new unsigned char[width_ * height_ * 4];
+    bool opaque = true;
 /*
     for (unsigned i = 0; i < width_ * height_; i++) {
       hslaColor hsl;
@@ -160,14 +416,35 @@ namespace cs221util {
       byteData[(i * 4) + 1] = imageData_[i].g;
       byteData[(i * 4) + 2] = imageData_[i].b;
       byteData[(i * 4) + 3] = imageData_[i].a * 255;
+      opaque = opaque && byteData[(i * 4) + 3] == 255;
+    }
+
+    // Filter type 2 (Up) for every row, for the presets that predefine filters
+    vector<unsigned char> upFilters(height_, 2);
+    vector<unsigned char> best;
+    unsigned error = 0;
+    for (unsigned attempt = 0; ; attempt++) {
+      lodepng::State state;
+      // Large images are deflated in chunks on every core
+      state.encoder.zlibsettings.threads = 0;
+      if (!encoderSettings(preset, attempt, width_, opaque, upFilters, state.encoder, state.info_png.color)) { break; }
+
+      vector<unsigned char> encoded;
+      unsigned attemptError = lodepng::encode(encoded, byteData, width_, height_, state);
+      if (attemptError) {
+        error = attemptError;
+      } else if (best.empty() || encoded.size() < best.size()) {
+        best.swap(encoded);
+      }
     }
+    delete[] byteData;
 
-    unsigned error = lodepng::encode(fileName, byteData, width_, height_);
+    if (!best.empty()) {
+      error = lodepng::save_file(best, fileName);
+    }
     if (error) {
       cerr << "PNG encoding error " << error << ": " << lodepng_error_text(error) << endl;
     }
-
-    delete[] byteData;
     return (error == 0);
   }
 
@@ -185,13 +462,13 @@ namespace cs221util {
 
     // Copy the current data to the new image data, using the existing pixel
     // for coordinates within the bounds of the old image size
-    for (unsigned x = 0; x < newWidth; x++) {
-      for (unsigned y = 0; y < newHeight; y++) {
-        if (x < width_ && y < height_) {
-          RGBAPixel * oldPixel = this->getPixel(x, y);
-          RGBAPixel & newPixel = newImageData[ (x + (y * newWidth)) ];
-          newPixel = *oldPixel;
-        }
+    unsigned copyWidth = min(newWidth, width_);
+    unsigned copyHeight = min(newHeight, height_);
+    for (unsigned y = 0; y < copyHeight; y++) {
+      RGBAPixel * oldRow = this->row(y);
+      RGBAPixel * newRow = newImageData + (size_t) y * newWidth;
+      for (unsigned x = 0; x < copyWidth; x++) {
+        newRow[x] = oldRow[x];
       }
     }
 
@@ -211,7 +488,7 @@ namespace cs221util {
 
     for (unsigned x = 0; x < this->width(); x++) {
       for (unsigned y = 0; y < this->height(); y++) {
-        RGBAPixel * pixel = this->getPixel(x, y);
+        RGBAPixel * pixel = this->row(y) + x;
         hash = (hash << 1) + hash + hashFunction(pixel->r);
         hash = (hash << 1) + hash + hashFunction(pixel->g);
         hash = (hash << 1) + hash + hashFunction(pixel->b);
@@ -222,6 +499,15 @@ namespace cs221util {
     return hash;
   }
 
+  uint64_t PNG::contentHash() const {
+    ContentHasher hasher;
+    hasher.updateDimensions(width_, height_);
+    for (RGBAPixel * row : rows()) {
+      hasher.updateRow(row, width_);
+    }
+    return hasher.digest();
+  }
+
   std::ostream & operator << ( std::ostream& os, PNG const& png ) {
     os << "PNG(w=" << png.width() << ", h=" << png.height() << ", hash=" << std::hex << png.computeHash() << std::dec << ")";
     return os;
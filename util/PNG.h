@@ -8,6 +8,8 @@
 #ifndef CS221_PNG_H_
 #define CS221_PNG_H_
 
+#include <cstdint>
+#include <functional>
 #include <string>
 #include <vector>
 //#include "HSLAPixel.h"
@@ -64,15 +66,62 @@ namespace cs221util {
       */
     bool operator!= (PNG const & other) const;
 
+    /**
+      * Summary of a pixel-by-pixel comparison of two images.
+      */
+    struct Comparison {
+      bool sameSize;             /*< Whether the two images have equal dimensions */
+      bool equal;                /*< Whether the images are the same size with no mismatching pixels */
+      size_t mismatches;         /*< Number of pixels that differ */
+      unsigned int maxDelta;     /*< Largest |r|, |g| or |b| difference over all pixels */
+      double maxAlphaDelta;      /*< Largest |a| difference over all pixels */
+      unsigned int firstX;       /*< X-coordinate of the first (row-major) mismatch */
+      unsigned int firstY;       /*< Y-coordinate of the first (row-major) mismatch */
+    };
+
+    /**
+      * Compares this image with another in a single vectorized pass.
+      * With tolerant set, pixels are matched exactly like
+      * RGBAPixel::operator== (alpha within 0.01, each of r, g, b within 2,
+      * and any pixel of this image with zero alpha matches); otherwise
+      * every channel must be identical. maxDelta and maxAlphaDelta cover
+      * all pixels regardless of the mode. If the sizes differ, nothing else
+      * is compared and all counters are zero.
+      * @param other Image to be checked.
+      * @param tolerant Whether to use the operator== tolerances.
+      * @return The comparison summary; firstX and firstY are only
+      * meaningful when mismatches is nonzero.
+      */
+    Comparison compare(PNG const & other, bool tolerant = true) const;
+
 
     /**
       * Reads in a PNG image from a file.
-      * Overwrites any current image content in the PNG.
+      * Overwrites any current image content in the PNG. Files written with
+      * ENCODE_FASTEST are decoded on several threads.
       * @param fileName Name of the file to be read from.
       * @return true, if the image was successfully read and loaded.
       */
     bool readFromFile(string const & fileName);
 
+    /**
+      * Receives one decoded row: y, a pointer to its width pixels (only
+      * valid during the call), and the image's width and height.
+      */
+    typedef std::function<void(unsigned int y, const RGBAPixel * row,
+                               unsigned int width, unsigned int height)> RowHandler;
+
+    /**
+      * Decodes a PNG file row by row, top to bottom, handing each row to
+      * handler instead of storing the image. Only a row's worth of pixels
+      * exists at a time, so consumers that keep a bounded window of rows
+      * can process images too large to hold in memory as RGBAPixels.
+      * @param fileName Name of the file to be read from.
+      * @param handler Called once per row.
+      * @return true, if the whole image was successfully decoded.
+      */
+    static bool readRows(string const & fileName, RowHandler const & handler);
+
     /**
       * Writes a PNG image to a file.
       * @param fileName Name of the file to be written.
@@ -80,6 +129,32 @@ namespace cs221util {
       */
     bool writeToFile(string const & fileName);
 
+    /**
+      * Trade-offs between encoding time and file size for writeToFile.
+      */
+    enum EncodePreset {
+      ENCODE_FASTEST,   /*< Every row Up-filtered, short LZ77 search, no color analysis */
+      ENCODE_BALANCED,  /*< LodePNG's defaults, as used by writeToFile(fileName) */
+      ENCODE_SMALLEST   /*< Maximum LZ77 effort; keeps the best of several filter strategies */
+    };
+
+    /**
+      * Writes a PNG image to a file with the given speed/size trade-off.
+      * ENCODE_FASTEST writes RGB or RGBA (whichever is lossless) without
+      * looking for a palette. It takes about half the time of
+      * ENCODE_BALANCED, and the file is usually within a few percent of
+      * its size, though images with few colors can come out several times
+      * larger for lack of a palette. Its files also record restart points
+      * every 256 KiB or so of rows, which readFromFile uses to decode
+      * large images on several threads; other decoders ignore them.
+      * ENCODE_SMALLEST encodes the image several times over,
+      * ENCODE_BALANCED's way first, and is never larger.
+      * @param fileName Name of the file to be written.
+      * @param preset How much time to spend on compression.
+      * @return true, if the image was successfully written.
+      */
+    bool writeToFile(string const & fileName, EncodePreset preset);
+
     /**
       * Pixel access operator. Gets a pointer to the pixel at the given
       * coordinates in the image. (0,0) is the upper left corner.
@@ -90,6 +165,67 @@ namespace cs221util {
       */
     RGBAPixel * getPixel(unsigned int x, unsigned int y) const;
 
+    /**
+      * Unchecked row access. Gets a pointer to the first pixel of row y;
+      * the row holds width() contiguous pixels. Unlike getPixel, no bounds
+      * checking or clamping is done, so y must be in [0, height()).
+      * @param y Row to be grabbed.
+      * @return A pointer to pixel (0, y).
+      */
+    RGBAPixel * row(unsigned int y) const { return imageData_ + (size_t) y * width_; }
+
+    /**
+      * Unchecked access to the raw pixel array. Pixel (x, y) lives at
+      * data()[x + y * stride()]. Returns NULL for an empty image.
+      * @return A pointer to pixel (0, 0).
+      */
+    RGBAPixel * data() const { return imageData_; }
+
+    /**
+      * Gets the distance, in pixels, between the starts of two
+      * consecutive rows of data().
+      * @return Row stride of the image.
+      */
+    unsigned int stride() const { return width_; }
+
+    /**
+      * Forward iterator over the rows of an image. Dereferences to the
+      * row pointer that row(y) would return.
+      */
+    class RowIterator {
+    public:
+      RowIterator(RGBAPixel * row, unsigned int stride) : row_(row), stride_(stride) { }
+      RGBAPixel * operator* () const { return row_; }
+      RowIterator & operator++ () { row_ += stride_; return *this; }
+      bool operator== (RowIterator const & other) const { return row_ == other.row_; }
+      bool operator!= (RowIterator const & other) const { return row_ != other.row_; }
+    private:
+      RGBAPixel * row_;
+      unsigned int stride_;
+    };
+
+    /**
+      * Range over all rows of the image, top to bottom, for use as
+      * `for (RGBAPixel * r : png.rows()) { ... }`.
+      */
+    class RowRange {
+    public:
+      RowRange(RGBAPixel * first, unsigned int stride, unsigned int count)
+        : first_(first), stride_(stride), count_(count) { }
+      RowIterator begin() const { return RowIterator(first_, stride_); }
+      RowIterator end() const { return RowIterator(first_ + (size_t) stride_ * count_, stride_); }
+    private:
+      RGBAPixel * first_;
+      unsigned int stride_;
+      unsigned int count_;
+    };
+
+    /**
+      * Gets a range over the rows of this image. No per-pixel checks.
+      * @return A RowRange covering rows [0, height()).
+      */
+    RowRange rows() const { return RowRange(imageData_, width_, height_); }
+
     /**
       * Gets the width of this image.
       * @return Width of the image.
@@ -116,6 +252,16 @@ namespace cs221util {
      */
     std::size_t computeHash() const;
 
+    /**
+     * Computes a 64-bit content hash of the image for caching and
+     * de-duplication. The width and height are hashed first, then the
+     * rows top to bottom over their RGBA8 encoding, with a ContentHasher,
+     * so the result can also be built up incrementally as rows are
+     * produced.
+     * @see ContentHash.h
+     */
+    uint64_t contentHash() const;
+
   private:
     unsigned int width_;            /*< Width of the image */
     unsigned int height_;           /*< Height of the image */
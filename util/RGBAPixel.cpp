@@ -7,8 +7,10 @@
  */
 
 #include "RGBAPixel.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
+#include "CPUFeatures.h"
 using namespace std;
 
 namespace cs221util {
@@ -87,7 +89,7 @@ namespace cs221util {
    *
    * @param other the other RGBAPixel to compare to this one
    */
-  double RGBAPixel::distanceTo(RGBAPixel other) {
+  double RGBAPixel::distanceTo(RGBAPixel const & other) const {
       // this pixel's color channels
       double r_this = (r / 255.0) * a;
       double g_this = (g / 255.0) * a;
@@ -111,6 +113,136 @@ namespace cs221util {
       return maxdiff_r + maxdiff_g + maxdiff_b;
   }
 
+  /*
+   * Batch distance kernels. Every path evaluates exactly the expression in
+   * distanceTo (same divides, multiplies and operand order, no fused
+   * multiply-add), so the results are bit-identical to the scalar method.
+   */
+  namespace {
+    // Premultiplied channels of the reference pixel, hoisted out of the loops.
+    struct DistanceRef {
+      double r, g, b, a;
+      explicit DistanceRef(RGBAPixel const & ref)
+        : r((ref.r / 255.0) * ref.a), g((ref.g / 255.0) * ref.a),
+          b((ref.b / 255.0) * ref.a), a(ref.a) { }
+    };
+
+    inline double distanceFrom(DistanceRef const & ref, RGBAPixel const & other) {
+      double r_diff = (other.r / 255.0) * other.a - ref.r;
+      double g_diff = (other.g / 255.0) * other.a - ref.g;
+      double b_diff = (other.b / 255.0) * other.a - ref.b;
+      double alphadiff = other.a - ref.a;
+
+      double maxdiff_r = max(r_diff * r_diff, (r_diff - alphadiff) * (r_diff - alphadiff));
+      double maxdiff_g = max(g_diff * g_diff, (g_diff - alphadiff) * (g_diff - alphadiff));
+      double maxdiff_b = max(b_diff * b_diff, (b_diff - alphadiff) * (b_diff - alphadiff));
+
+      return maxdiff_r + maxdiff_g + maxdiff_b;
+    }
+
+#ifdef CS221_X86_DISPATCH
+    // Squared channel difference term for four pixels at once.
+    __attribute__((target("avx2")))
+    inline __m256d channelTerm(__m256d channel, __m256d alpha, __m256d refChannel, __m256d alphadiff) {
+      __m256d diff = _mm256_sub_pd(_mm256_mul_pd(_mm256_div_pd(channel, _mm256_set1_pd(255.0)), alpha), refChannel);
+      __m256d shifted = _mm256_sub_pd(diff, alphadiff);
+      // max(x, y) with the scalar std::max operand order: y if x < y, else x
+      return _mm256_max_pd(_mm256_mul_pd(shifted, shifted), _mm256_mul_pd(diff, diff));
+    }
+
+    // Distances from ref to pixels p[0..3].
+    __attribute__((target("avx2")))
+    inline __m256d distance4(DistanceRef const & ref, RGBAPixel const * p) {
+      __m256d r = _mm256_set_pd(p[3].r, p[2].r, p[1].r, p[0].r);
+      __m256d g = _mm256_set_pd(p[3].g, p[2].g, p[1].g, p[0].g);
+      __m256d b = _mm256_set_pd(p[3].b, p[2].b, p[1].b, p[0].b);
+      __m256d a = _mm256_set_pd(p[3].a, p[2].a, p[1].a, p[0].a);
+      __m256d alphadiff = _mm256_sub_pd(a, _mm256_set1_pd(ref.a));
+
+      __m256d sum = _mm256_add_pd(channelTerm(r, a, _mm256_set1_pd(ref.r), alphadiff),
+                                  channelTerm(g, a, _mm256_set1_pd(ref.g), alphadiff));
+      return _mm256_add_pd(sum, channelTerm(b, a, _mm256_set1_pd(ref.b), alphadiff));
+    }
+
+    // Each of these handles the largest multiple of 4 pixels and returns
+    // how many it consumed; the caller finishes the tail with distanceFrom.
+    __attribute__((target("avx2")))
+    size_t distancesAVX2(DistanceRef const & ref, RGBAPixel const * pixels, size_t count, double * out) {
+      size_t i = 0;
+      for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, distance4(ref, pixels + i));
+      }
+      return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t maxDistanceAVX2(DistanceRef const & ref, RGBAPixel const * pixels, size_t count, double & result) {
+      __m256d best = _mm256_setzero_pd();
+      size_t i = 0;
+      for (; i + 4 <= count; i += 4) {
+        best = _mm256_max_pd(best, distance4(ref, pixels + i));
+      }
+      double lanes[4];
+      _mm256_storeu_pd(lanes, best);
+      for (double d : lanes) {
+        result = max(result, d);
+      }
+      return i;
+    }
+
+    __attribute__((target("avx2")))
+    size_t withinDistanceAVX2(DistanceRef const & ref, RGBAPixel const * pixels, size_t count, double tol, bool & within) {
+      __m256d limit = _mm256_set1_pd(tol);
+      size_t i = 0;
+      for (; i + 4 <= count; i += 4) {
+        // !(d <= tol), so that NaN distances fail just like in the scalar test
+        if (_mm256_movemask_pd(_mm256_cmp_pd(distance4(ref, pixels + i), limit, _CMP_NLE_UQ))) {
+          within = false;
+          return count;
+        }
+      }
+      return i;
+    }
+#endif
+  }
+
+  void distancesTo(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count, double * out) {
+    DistanceRef dref(ref);
+    size_t i = 0;
+#ifdef CS221_X86_DISPATCH
+    if (cpuHasAVX2()) { i = distancesAVX2(dref, pixels, count, out); }
+#endif
+    for (; i < count; i++) {
+      out[i] = distanceFrom(dref, pixels[i]);
+    }
+  }
+
+  double maxDistanceTo(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count) {
+    DistanceRef dref(ref);
+    double result = 0;
+    size_t i = 0;
+#ifdef CS221_X86_DISPATCH
+    if (cpuHasAVX2()) { i = maxDistanceAVX2(dref, pixels, count, result); }
+#endif
+    for (; i < count; i++) {
+      result = max(result, distanceFrom(dref, pixels[i]));
+    }
+    return result;
+  }
+
+  bool allWithinDistance(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count, double tol) {
+    DistanceRef dref(ref);
+    bool within = true;
+    size_t i = 0;
+#ifdef CS221_X86_DISPATCH
+    if (cpuHasAVX2()) { i = withinDistanceAVX2(dref, pixels, count, tol, within); }
+#endif
+    for (; within && i < count; i++) {
+      within = distanceFrom(dref, pixels[i]) <= tol;
+    }
+    return within;
+  }
+
   std::ostream & operator<<(std::ostream & out, RGBAPixel const & pixel) {
     out << "(" << pixel.r << ", " << pixel.g << ", " << pixel.b << (pixel.a != 1 ? ", " + std::to_string(pixel.a) : "") << ")";
 
@@ -8,6 +8,7 @@
 #ifndef CS221_RGBAPIXEL_H_
 #define CS221_RGBAPIXEL_H_
 
+#include <cstddef>
 #include <iostream>
 #include <sstream>
 
@@ -65,9 +66,44 @@ namespace cs221util {
      * 
      * @param other the other RGBAPixel to compare to this one
      */
-    double distanceTo(RGBAPixel other);
+    double distanceTo(RGBAPixel const & other) const;
   };
 
+  /**
+   * Batch form of RGBAPixel::distanceTo. Writes ref.distanceTo(pixels[i])
+   * to out[i] for every i in [0, count). Uses AVX2 when the CPU supports
+   * it and a scalar loop otherwise; both perform the same IEEE operations
+   * in the same order as distanceTo, so results match it bit-for-bit.
+   *
+   * @param ref the reference color
+   * @param pixels array of count pixels to measure against ref
+   * @param count number of pixels
+   * @param out array of count distances
+   */
+  void distancesTo(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count, double * out);
+
+  /**
+   * Computes the largest ref.distanceTo(pixels[i]) over the array, or 0 if
+   * the array is empty. Bit-for-bit equal to the scalar maximum.
+   *
+   * @param ref the reference color
+   * @param pixels array of count pixels to measure against ref
+   * @param count number of pixels
+   */
+  double maxDistanceTo(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count);
+
+  /**
+   * Returns whether every pixel in the array is within tol of ref, i.e.
+   * whether maxDistanceTo(ref, pixels, count) <= tol. Stops at the first
+   * block containing a pixel that is too far away.
+   *
+   * @param ref the reference color
+   * @param pixels array of count pixels to measure against ref
+   * @param count number of pixels
+   * @param tol maximum allowable distance
+   */
+  bool allWithinDistance(RGBAPixel const & ref, RGBAPixel const * pixels, size_t count, double tol);
+
   /**
    * Stream operator that allows pixels to be written to standard streams
    * (like cout).
@@ -0,0 +1,186 @@
+/**
+ * @file RangeCoder.h
+ * Adaptive binary range coder (in the style of LZMA's) for compact
+ * bitstreams with context modeling.
+ */
+
+#ifndef CS221_RANGECODER_H_
+#define CS221_RANGECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace cs221util {
+  /**
+   * Probability that the next bit is 0, in units of 1/2048. Each context of
+   * a model owns one; it starts at 1/2 and adapts to the bits coded with it.
+   */
+  typedef uint16_t BitProbability;
+
+  /** Initial value of every BitProbability. */
+  const BitProbability BIT_PROBABILITY_INIT = 1024;
+
+  /**
+   * Encodes bits into a byte vector. Every bit is coded with a probability
+   * that is updated afterwards, so bits that are predictable in their
+   * context cost much less than one bit each.
+   */
+  class RangeEncoder {
+  public:
+    /**
+     * Starts encoding, appending to out.
+     * @param out Vector receiving the coded bytes.
+     */
+    explicit RangeEncoder(std::vector<unsigned char> & out)
+      : out_(out), low_(0), range_(0xFFFFFFFFu), cache_(0), cacheSize_(1) { }
+
+    /**
+     * Encodes one bit and adapts its probability.
+     * @param probability Context the bit is coded in.
+     * @param bit The bit.
+     */
+    void encode(BitProbability & probability, unsigned int bit) {
+      uint32_t bound = (range_ >> 11) * probability;
+      if (bit == 0) {
+        range_ = bound;
+        probability += (2048 - probability) >> 5;
+      } else {
+        low_ += bound;
+        range_ -= bound;
+        probability -= probability >> 5;
+      }
+      while (range_ < (1u << 24)) {
+        range_ <<= 8;
+        shiftLow();
+      }
+    }
+
+    /**
+     * Encodes the low bits of value, most significant first, with a binary
+     * tree of probabilities: each bit is coded in the context of the bits
+     * above it. probabilities must hold 2^bits entries.
+     * @param probabilities The tree's contexts.
+     * @param bits Number of bits to code.
+     * @param value The value.
+     */
+    void encodeTree(BitProbability * probabilities, unsigned int bits, unsigned int value) {
+      unsigned int node = 1;
+      for (unsigned int i = bits; i > 0; i--) {
+        unsigned int bit = (value >> (i - 1)) & 1;
+        encode(probabilities[node], bit);
+        node = (node << 1) | bit;
+      }
+    }
+
+    /**
+     * Writes out the remaining state; nothing may be encoded afterwards.
+     */
+    void finish() {
+      for (int i = 0; i < 5; i++) {
+        shiftLow();
+      }
+    }
+
+  private:
+    void shiftLow() {
+      if ((uint32_t) low_ < 0xFF000000u || (low_ >> 32) != 0) {
+        unsigned char carry = (unsigned char) (low_ >> 32);
+        unsigned char pending = cache_;
+        do {
+          out_.push_back((unsigned char) (pending + carry));
+          pending = 0xFF;
+        } while (--cacheSize_ != 0);
+        cache_ = (unsigned char) (low_ >> 24);
+      }
+      cacheSize_++;
+      low_ = (low_ & 0x00FFFFFFu) << 8;
+    }
+
+    std::vector<unsigned char> & out_;  /*< Destination of the coded bytes */
+    uint64_t low_;                      /*< Low end of the interval, with a carry bit */
+    uint32_t range_;                    /*< Width of the interval */
+    unsigned char cache_;               /*< Last byte not yet written, as it may receive a carry */
+    uint64_t cacheSize_;                /*< Number of pending bytes (cache_ and 0xFFs) */
+  };
+
+  /**
+   * Decodes bits written by a RangeEncoder, given the same sequence of
+   * contexts. Reading past the end of the input yields zero bytes and is
+   * reported by overrun(), so corrupt streams cannot run away.
+   */
+  class RangeDecoder {
+  public:
+    /**
+     * Starts decoding.
+     * @param data The coded bytes.
+     * @param size Number of coded bytes.
+     */
+    RangeDecoder(const unsigned char * data, size_t size)
+      : data_(data), size_(size), pos_(0), range_(0xFFFFFFFFu), code_(0) {
+      for (int i = 0; i < 5; i++) {
+        code_ = (code_ << 8) | next();
+      }
+    }
+
+    /**
+     * Decodes one bit and adapts its probability.
+     * @param probability Context the bit was coded in.
+     * @return The bit.
+     */
+    unsigned int decode(BitProbability & probability) {
+      uint32_t bound = (range_ >> 11) * probability;
+      unsigned int bit;
+      if (code_ < bound) {
+        range_ = bound;
+        probability += (2048 - probability) >> 5;
+        bit = 0;
+      } else {
+        code_ -= bound;
+        range_ -= bound;
+        probability -= probability >> 5;
+        bit = 1;
+      }
+      while (range_ < (1u << 24)) {
+        range_ <<= 8;
+        code_ = (code_ << 8) | next();
+      }
+      return bit;
+    }
+
+    /**
+     * Decodes a value written by RangeEncoder::encodeTree.
+     * @param probabilities The tree's contexts.
+     * @param bits Number of bits coded.
+     * @return The value.
+     */
+    unsigned int decodeTree(BitProbability * probabilities, unsigned int bits) {
+      unsigned int node = 1;
+      for (unsigned int i = 0; i < bits; i++) {
+        node = (node << 1) | decode(probabilities[node]);
+      }
+      return node - (1u << bits);
+    }
+
+    /**
+     * @return Whether the decoder has needed bytes beyond the input,
+     * which never happens for a complete stream.
+     */
+    bool overrun() const { return pos_ > size_; }
+
+  private:
+    unsigned char next() {
+      unsigned char byte = pos_ < size_ ? data_[pos_] : 0;
+      pos_++;
+      return byte;
+    }
+
+    const unsigned char * data_;  /*< The coded bytes */
+    size_t size_;                 /*< Number of coded bytes */
+    size_t pos_;                  /*< Bytes consumed so far */
+    uint32_t range_;              /*< Width of the interval */
+    uint32_t code_;               /*< Position of the stream within the interval */
+  };
+}
+
+#endif
@@ -26,6 +26,9 @@ freely, subject to the following restrictions:
 /*
 The manual and changelog are in the header file "lodepng.h"
 Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for C.
+
+This is an altered copy of LodePNG: functions added locally are marked
+"Local addition" where they are declared in lodepng.h.
 */
 
 #include "lodepng.h"
@@ -34,6 +37,18 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef LODEPNG_COMPILE_CPP
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#endif /*LODEPNG_COMPILE_CPP*/
+
+/*x86 compilers that can build SSE2, PCLMUL or AVX2 code for single functions, whatever the target (Local addition)*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LODEPNG_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -123,6 +138,34 @@ Example: if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83);
   return;\
 }
 
+#ifdef LODEPNG_COMPILE_CPP
+/*
+Runs work on up to count threads, the calling thread being one of them, and returns once all of them
+have. work must take its tasks from a shared counter until none are left, so that if a thread can't be
+started, the others do its share. count 0 means one thread per CPU core. (Local addition)
+*/
+template<typename Work>
+static void lodepng_run_threads(size_t count, const Work& work)
+{
+  std::vector<std::thread> workers;
+  size_t i;
+  if(count == 0) count = std::max(std::thread::hardware_concurrency(), 1u);
+  for(i = 1; i < count; ++i)
+  {
+    try
+    {
+      workers.emplace_back(work);
+    }
+    catch(...)
+    {
+      break;
+    }
+  }
+  work();
+  for(i = 0; i != workers.size(); ++i) workers[i].join();
+}
+#endif /*LODEPNG_COMPILE_CPP*/
+
 /*
 About uivector, ucvector and string:
 -All of them wrap dynamic arrays or text strings in a similar way.
@@ -270,6 +313,62 @@ static unsigned ucvector_push_back(ucvector* p, unsigned char c)
 }
 #endif /*defined(LODEPNG_COMPILE_PNG) || defined(LODEPNG_COMPILE_ENCODER)*/
 
+#ifdef LODEPNG_COMPILE_DECODER
+/*
+A piece of compressed input, read as if it were joined to the pieces before it: the zlib stream of a
+PNG is the data of all its IDAT chunks put together, which the decoder reads in place in the PNG.
+(Local addition, not part of upstream LodePNG, which copied the IDAT data into one buffer.)
+*/
+typedef struct InflateSegment
+{
+  const unsigned char* data;
+  size_t size;
+} InflateSegment;
+
+#ifdef LODEPNG_COMPILE_PNG
+/*dynamic vector of InflateSegments, along with the total size of the input they make up*/
+typedef struct segvector
+{
+  InflateSegment* data;
+  size_t size; /*size in number of segments*/
+  size_t allocsize; /*allocated size in bytes*/
+  size_t insize; /*sum of the sizes of the segments*/
+} segvector;
+
+static void segvector_init(segvector* p)
+{
+  p->data = NULL;
+  p->size = p->allocsize = p->insize = 0;
+}
+
+static void segvector_cleanup(segvector* p)
+{
+  p->size = p->allocsize = p->insize = 0;
+  lodepng_free(p->data);
+  p->data = NULL;
+}
+
+/*returns 1 if success, 0 if failure ==> nothing done*/
+static unsigned segvector_push_back(segvector* p, const unsigned char* data, size_t size)
+{
+  size_t needed = (p->size + 1) * sizeof(InflateSegment);
+  if(needed > p->allocsize)
+  {
+    size_t newsize = needed * 2;
+    void* grown = lodepng_realloc(p->data, newsize);
+    if(!grown) return 0;
+    p->data = (InflateSegment*)grown;
+    p->allocsize = newsize;
+  }
+  p->data[p->size].data = data;
+  p->data[p->size].size = size;
+  ++p->size;
+  p->insize += size;
+  return 1;
+}
+#endif /*LODEPNG_COMPILE_PNG*/
+#endif /*LODEPNG_COMPILE_DECODER*/
+
 
 /* ////////////////////////////////////////////////////////////////////////// */
 
@@ -442,23 +541,164 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Reads the deflate bitstream, least significant bit first, through a 64-bit buffer refilled a
+whole word at a time, so that one refill serves several symbols and extra bits.
+(Local addition, not part of upstream LodePNG, which read the input one bit at a time.)
+Bits past the end of the input read as 0 without touching memory; bp counts the bits
+consumed, and callers check it against bitsize before trusting what they read.
+The input may be split into segments, which read as one: positions, bp and bitsize are
+counted over all of them, while data, size and next describe the segment being loaded.
+*/
+typedef struct BitReader
+{
+  const unsigned char* data; /*the current segment*/
+  size_t size; /*size of the current segment in bytes*/
+  size_t start; /*position of the current segment in the input, in bytes*/
+  const InflateSegment* segments; /*all segments, or null if data is the whole input*/
+  size_t numsegments;
+  size_t segment; /*index of the current segment*/
+  size_t bitsize; /*size of the input in bits*/
+  size_t bp; /*number of bits consumed*/
+  size_t next; /*next byte of the current segment to enter the buffer*/
+  unsigned long long buffer; /*the bits from bp on, the first in the least significant bit*/
+  unsigned avail; /*number of valid bits in buffer*/
+} BitReader;
+
+/*moves on to the segment after the current one; returns 0, changing nothing, if there is none*/
+static unsigned BitReader_nextSegment(BitReader* reader)
+{
+  if(reader->segment + 1 >= reader->numsegments) return 0;
+  reader->start += reader->size;
+  reader->next -= reader->size;
+  ++reader->segment;
+  reader->data = reader->segments[reader->segment].data;
+  reader->size = reader->segments[reader->segment].size;
+  return 1;
+}
+
+/*makes the segment holding byte pos of the input current, and the next byte to load pos*/
+static void BitReader_locate(BitReader* reader, size_t pos)
+{
+  /*the buffer reads at most 8 bytes ahead, so this only ever steps back over a few segments*/
+  while(pos < reader->start)
+  {
+    --reader->segment;
+    reader->data = reader->segments[reader->segment].data;
+    reader->size = reader->segments[reader->segment].size;
+    reader->start -= reader->size;
+  }
+  reader->next = pos - reader->start;
+  while(reader->next >= reader->size && BitReader_nextSegment(reader)) {}
+}
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+/*fills the buffer up to at least 56 bits, or with the rest of the input*/
+static void BitReader_refill(BitReader* reader)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  if(reader->next + 8 <= reader->size)
+  {
+    /*
+    Load a whole word and keep the bytes that fit. The bits of a partly kept byte above
+    avail are the same ones the next refill loads again, so or-ing them in twice is harmless.
+    */
+    const unsigned char* p = &reader->data[reader->next];
+    unsigned long long word = (unsigned long long)p[0] | ((unsigned long long)p[1] << 8)
+                            | ((unsigned long long)p[2] << 16) | ((unsigned long long)p[3] << 24)
+                            | ((unsigned long long)p[4] << 32) | ((unsigned long long)p[5] << 40)
+                            | ((unsigned long long)p[6] << 48) | ((unsigned long long)p[7] << 56);
+    reader->buffer |= word << reader->avail;
+    reader->next += (63 - reader->avail) >> 3;
+    reader->avail |= 56;
+  }
+  else
+  {
+    while(reader->avail <= 56)
+    {
+      if(reader->next >= reader->size)
+      {
+        if(!BitReader_nextSegment(reader)) break;
+        continue;
+      }
+      reader->buffer |= (unsigned long long)reader->data[reader->next++] << reader->avail;
+      reader->avail += 8;
+    }
+  }
+}
+
+/*positions the reader at bit bp of the input*/
+static void BitReader_seek(BitReader* reader, size_t bp)
+{
+  reader->bp = bp & ~(size_t)7;
+  BitReader_locate(reader, bp >> 3);
+  reader->buffer = 0;
+  reader->avail = 0;
+  BitReader_refill(reader);
+  reader->bp = bp;
+  reader->buffer >>= bp & 7;
+  reader->avail = reader->avail > (bp & 7) ? reader->avail - (unsigned)(bp & 7) : 0;
+}
+
+static void BitReader_init(BitReader* reader, const unsigned char* data, size_t size)
+{
+  reader->data = data;
+  reader->size = size;
+  reader->start = 0;
+  reader->segments = 0;
+  reader->numsegments = 0;
+  reader->segment = 0;
+  reader->bitsize = size * 8;
+  BitReader_seek(reader, 0);
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*reads the segments, whose sizes add up to insize, as one input*/
+static void BitReader_initSegments(BitReader* reader, const InflateSegment* segments, size_t numsegments,
+                                   size_t insize)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
+  BitReader_init(reader, numsegments ? segments[0].data : 0, numsegments ? segments[0].size : 0);
+  reader->segments = segments;
+  reader->numsegments = numsegments;
+  reader->bitsize = insize * 8;
+  BitReader_seek(reader, 0);
+}
+
+/*copies the count bytes of the input from byte pos on, which must all exist, and positions the reader after them*/
+static void BitReader_readBytes(BitReader* reader, unsigned char* out, size_t pos, size_t count)
+{
+  size_t end = pos + count;
+  BitReader_locate(reader, pos);
+  while(pos < end)
   {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
+    size_t n = reader->size - reader->next;
+    if(n > end - pos) n = end - pos;
+    if(n) memcpy(out, reader->data + reader->next, n);
+    out += n;
+    pos += n;
+    reader->next += n;
+    if(pos < end && !BitReader_nextSegment(reader)) break;
   }
+  BitReader_seek(reader, end * 8);
+}
+
+/*returns the next nbits (at most 56) bits without consuming them*/
+static unsigned BitReader_peekBits(BitReader* reader, unsigned nbits)
+{
+  if(reader->avail < nbits) BitReader_refill(reader);
+  return (unsigned)(reader->buffer & ((1ull << nbits) - 1u));
+}
+
+/*consumes nbits bits, which a peek of at least nbits must have preceded*/
+static void BitReader_advanceBits(BitReader* reader, unsigned nbits)
+{
+  reader->bp += nbits;
+  reader->buffer >>= nbits;
+  /*only past the end of the input can the buffer hold fewer bits than were peeked*/
+  reader->avail = reader->avail > nbits ? reader->avail - nbits : 0;
+}
+
+static unsigned BitReader_readBits(BitReader* reader, unsigned nbits)
+{
+  unsigned result = BitReader_peekBits(reader, nbits);
+  BitReader_advanceBits(reader, nbits);
   return result;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -513,6 +753,10 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*lookup tables made from tree2d by HuffmanTree_makeTable for the decoder, or 0 if there are none*/
+  unsigned short* table_value; /*symbol, or start of the second-level table if table_len > HUFFMAN_TABLE_BITS*/
+  unsigned char* table_len; /*bits the entry consumes, or HUFFMAN_TABLE_BITS + bits of its second-level table*/
+  unsigned table_size; /*number of entries, first-level table included*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -533,6 +777,9 @@ static void HuffmanTree_init(HuffmanTree* tree)
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_value = 0;
+  tree->table_len = 0;
+  tree->table_size = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -540,6 +787,8 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_value);
+  lodepng_free(tree->table_len);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -940,23 +1189,131 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
+/*
+Table-driven decoding (local addition, not part of upstream LodePNG). The first HUFFMAN_TABLE_BITS
+bits of the input index a table that gives the symbol and code length directly. Codes longer than
+that lead to a second-level table, indexed by the bits after the first HUFFMAN_TABLE_BITS, that
+is just large enough for the longest code below that prefix. The tables are made by walking
+tree2d, so they decode exactly like it, including the bit patterns a malformed tree leaves
+undefined or makes jump outside the tree.
+*/
+#define HUFFMAN_TABLE_BITS 9u
+/*table_value of bit patterns huffmanDecodeSymbol reports as an error*/
+#define HUFFMAN_INVALID_SYMBOL 65535u
+
+/*number of bits of the longest path below tree2d position treepos, if at most maxdepth*/
+static unsigned HuffmanTree_depth(const HuffmanTree* tree, unsigned treepos, unsigned maxdepth)
+{
+  unsigned bit, depth = 0;
+  for(bit = 0; bit != 2 && maxdepth != 0; ++bit)
+  {
+    unsigned ct = tree->tree2d[(treepos << 1) + bit];
+    unsigned d = 1;
+    if(ct >= tree->numcodes && ct - tree->numcodes < tree->numcodes)
+    {
+      d += HuffmanTree_depth(tree, ct - tree->numcodes, maxdepth - 1);
+    }
+    if(d > depth) depth = d;
+  }
+  return depth;
+}
+
+/*
+Fills the table of 2^bits entries at base for the subtree at tree2d position treepos, reached
+after consuming length bits, depth of them in this table, which are the low bits of pattern.
+Returns error code.
+*/
+static unsigned HuffmanTree_fillTable(HuffmanTree* tree, unsigned base, unsigned bits, unsigned treepos,
+                                      unsigned depth, unsigned pattern, unsigned length)
+{
+  unsigned bit, j;
+  for(bit = 0; bit != 2; ++bit)
+  {
+    unsigned ct = tree->tree2d[(treepos << 1) + bit];
+    unsigned index = pattern | (bit << depth);
+    unsigned value;
+    if(ct < tree->numcodes) value = ct;
+    else if(ct - tree->numcodes >= tree->numcodes) value = HUFFMAN_INVALID_SYMBOL;
+    else if(depth + 1 < bits)
+    {
+      unsigned error = HuffmanTree_fillTable(tree, base, bits, ct - tree->numcodes, depth + 1, index, length + 1);
+      if(error) return error;
+      continue;
+    }
+    else if(base == 0)
+    {
+      /*the code goes on past the first-level table: append a second-level table for the rest*/
+      unsigned subbits = HuffmanTree_depth(tree, ct - tree->numcodes, 15 - HUFFMAN_TABLE_BITS);
+      unsigned start = tree->table_size;
+      unsigned size = start + (1u << subbits);
+      unsigned short* table_value;
+      unsigned char* table_len;
+      unsigned error;
+      table_value = (unsigned short*)lodepng_realloc(tree->table_value, size * sizeof(unsigned short));
+      if(table_value) tree->table_value = table_value;
+      table_len = (unsigned char*)lodepng_realloc(tree->table_len, size);
+      if(table_len) tree->table_len = table_len;
+      if(!table_value || !table_len) return 83; /*alloc fail*/
+      tree->table_size = size;
+      tree->table_value[index] = (unsigned short)start;
+      tree->table_len[index] = (unsigned char)(HUFFMAN_TABLE_BITS + subbits);
+      error = HuffmanTree_fillTable(tree, start, subbits, ct - tree->numcodes, 0, 0, length + 1);
+      if(error) return error;
+      continue;
+    }
+    /*deeper than any code tree2d can hold; decoding it bit by bit would not end either*/
+    else value = HUFFMAN_INVALID_SYMBOL;
+
+    for(j = index; j < (1u << bits); j += 1u << (depth + 1))
+    {
+      tree->table_value[base + j] = (unsigned short)value;
+      tree->table_len[base + j] = (unsigned char)(length + 1);
+    }
+  }
+  return 0;
+}
+
+/*makes the lookup tables of a tree made by HuffmanTree_make2DTree. return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  tree->table_size = 1u << HUFFMAN_TABLE_BITS;
+  tree->table_value = (unsigned short*)lodepng_malloc(tree->table_size * sizeof(unsigned short));
+  tree->table_len = (unsigned char*)lodepng_malloc(tree->table_size);
+  if(!tree->table_value || !tree->table_len) return 83; /*alloc fail*/
+  return HuffmanTree_fillTable(tree, 0, HUFFMAN_TABLE_BITS, 0, 0, 0, 0);
+}
+
 /*
 returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+reads bits until the code is complete or the input (of reader->bitsize bits) ends
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(BitReader* reader, const HuffmanTree* codetree)
 {
   unsigned treepos = 0, ct;
+
+  if(codetree->table_len)
+  {
+    unsigned bits = BitReader_peekBits(reader, 15);
+    unsigned index = bits & ((1u << HUFFMAN_TABLE_BITS) - 1u);
+    unsigned len = codetree->table_len[index];
+    if(len > HUFFMAN_TABLE_BITS)
+    {
+      index = codetree->table_value[index] + ((bits >> HUFFMAN_TABLE_BITS) & ((1u << (len - HUFFMAN_TABLE_BITS)) - 1u));
+      len = codetree->table_len[index];
+    }
+    /*a code running past the end of the input fails below exactly as it always did*/
+    if(reader->bp + len <= reader->bitsize)
+    {
+      BitReader_advanceBits(reader, len);
+      ct = codetree->table_value[index];
+      return ct == HUFFMAN_INVALID_SYMBOL ? (unsigned)(-1) : ct;
+    }
+  }
+
   for(;;)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
+    if(reader->bp >= reader->bitsize) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+    ct = codetree->tree2d[(treepos << 1) + BitReader_readBits(reader, 1)];
     if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
     else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
 
@@ -972,21 +1329,22 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* ////////////////////////////////////////////////////////////////////////// */
 
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  unsigned error = generateFixedLitLenTree(tree_ll);
+  if(!error) error = generateFixedDistanceTree(tree_d);
+  if(!error) error = HuffmanTree_makeTable(tree_ll);
+  if(!error) error = HuffmanTree_makeTable(tree_d);
+  return error;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d, BitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
+  size_t inbitlength = reader->bitsize;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -995,16 +1353,16 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + 14 > inbitlength) return 49; /*error: the bit pointer is or will go past the memory*/
 
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  BitReader_readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = BitReader_readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = BitReader_readBits(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + HCLEN * 3 > inbitlength) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -1017,7 +1375,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = BitReader_readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -1035,7 +1393,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1049,8 +1407,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if(i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        if(reader->bp + 2 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += BitReader_readBits(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1066,8 +1424,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        if(reader->bp + 3 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += BitReader_readBits(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1082,8 +1440,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        if(reader->bp + 7 > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += BitReader_readBits(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1101,7 +1459,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
+          error = reader->bp > inbitlength ? 10 : 11;
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -1115,6 +1473,10 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     error = HuffmanTree_makeFromLengths(tree_ll, bitlen_ll, NUM_DEFLATE_CODE_SYMBOLS, 15);
     if(error) break;
     error = HuffmanTree_makeFromLengths(tree_d, bitlen_d, NUM_DISTANCE_SYMBOLS, 15);
+    if(error) break;
+    error = HuffmanTree_makeTable(tree_ll);
+    if(error) break;
+    error = HuffmanTree_makeTable(tree_d);
 
     break; /*end of error-while*/
   }
@@ -1127,29 +1489,60 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
+/*
+Copies a length/distance pair's length bytes to dst from distance bytes before it. When distance is
+smaller than length the source overlaps the bytes being written, so the copy repeats the last distance
+bytes: from at least 8 back that is done 8 bytes at a time, each chunk lying wholly before its
+destination, and a shorter pattern is copied once and then doubled until it fills the length.
+*/
+static void copyBackReference(unsigned char* dst, size_t distance, size_t length)
+{
+  const unsigned char* src = dst - distance;
+  if(distance >= length)
+  {
+    memcpy(dst, src, length);
+  }
+  else if(distance >= 8)
+  {
+    size_t i = 0;
+    for(; i + 8 <= length; i += 8) memcpy(dst + i, src + i, 8);
+    for(; i < length; ++i) dst[i] = src[i];
+  }
+  else
+  {
+    size_t done = distance;
+    memcpy(dst, src, distance);
+    /*dst holds a whole number of periods, so copying a prefix of it continues the pattern*/
+    while(done < length)
+    {
+      size_t chunk = done < length - done ? done : length - done;
+      memcpy(dst + done, dst, chunk);
+      done += chunk;
+    }
+  }
+}
+
 /*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+static unsigned inflateHuffmanBlock(ucvector* out, BitReader* reader, size_t* pos, unsigned btype)
 {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  size_t inbitlength = reader->bitsize;
 
   HuffmanTree_init(&tree_ll);
   HuffmanTree_init(&tree_d);
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+  if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
   while(!error) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll = huffmanDecodeSymbol(reader, &tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
-      /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
+      if(*pos >= out->allocsize && !ucvector_reserve(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
       out->data[*pos] = (unsigned char)code_ll;
       ++(*pos);
     }
@@ -1157,25 +1550,25 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t start, length;
 
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if(reader->bp + numextrabits_l > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      length += BitReader_readBits(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, &tree_d);
       if(code_d > 29)
       {
         if(code_d == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = reader->bp > inbitlength ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1184,24 +1577,16 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      if(reader->bp + numextrabits_d > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      distance += BitReader_readBits(reader, numextrabits_d);
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
       start = (*pos);
       if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
-      backward = start - distance;
 
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
-      if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
-      } else {
-        memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
-      }
+      if(out->allocsize - start < length && !ucvector_reserve(out, start + length)) ERROR_BREAK(83 /*alloc fail*/);
+      copyBackReference(out->data + start, distance, length);
+      *pos += length;
     }
     else if(code_ll == 256)
     {
@@ -1211,99 +1596,155 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      error = reader->bp > inbitlength ? 10 : 11;
       break;
     }
   }
 
+  /*out was only grown as far as needed above, its size is brought up to date once*/
+  out->size = *pos;
+
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
 
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, BitReader* reader, size_t* pos)
 {
+  size_t inlength = reader->bitsize / 8;
   size_t p;
-  unsigned LEN, NLEN, n, error = 0;
+  unsigned char lengths[4];
+  unsigned LEN, NLEN, error = 0;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  p = (reader->bp + 7) / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
-  LEN = in[p] + 256u * in[p + 1]; p += 2;
-  NLEN = in[p] + 256u * in[p + 1]; p += 2;
+  BitReader_readBytes(reader, lengths, p, 4);
+  LEN = lengths[0] + 256u * lengths[1];
+  NLEN = lengths[2] + 256u * lengths[3];
+  p += 4;
 
   /*check if 16-bit NLEN is really the one's complement of LEN*/
   if(LEN + NLEN != 65535) return 21; /*error: NLEN is not one's complement of LEN*/
 
   if(!ucvector_resize(out, (*pos) + LEN)) return 83; /*alloc fail*/
 
-  /*read the literal data: LEN bytes are now stored in the out buffer*/
+  /*read the literal data: LEN bytes are now stored in the out buffer, and the reader is past them*/
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
-  for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
-
-  (*bp) = p * 8;
+  BitReader_readBytes(reader, out->data + *pos, p, LEN);
+  *pos += LEN;
 
   return error;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings)
+/*Receives the decompressed data piece by piece when inflating as a stream. write returns an error code.*/
+typedef struct InflateSink
+{
+  unsigned (*write)(void* user, const unsigned char* data, size_t size);
+  void* user;
+} InflateSink;
+
+/*deflate back-references reach at most this far, so a stream only needs to keep this much history*/
+static const size_t INFLATE_WINDOW_SIZE = 32768;
+/*when streaming, finished data is handed to the sink once the out buffer holds this much*/
+static const size_t INFLATE_FLUSH_SIZE = 131072;
+
+/*
+Inflates the blocks from the reader's position on: up to the final block if end is 0, or else up to
+bit end of the input, where the next band of a stream with restart points starts. The blocks of such
+a band must not be final and must stop exactly at end. (Local addition, not part of upstream LodePNG:
+end generalizes the loop lodepng_inflatev had.)
+If sink is null, the whole decompressed data is left in out. Otherwise, after each block that leaves
+more than INFLATE_FLUSH_SIZE bytes in out, everything but the last INFLATE_WINDOW_SIZE bytes (still
+needed for back-references) is handed to the sink and dropped, and the remainder is handed over at
+the end. out then only ever holds the window plus the output of one block.
+*/
+static unsigned inflateBlocks(ucvector* out, BitReader* reader, const InflateSink* sink, size_t end)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
 
-  (void)settings;
-
-  while(!BFINAL)
+  while(!BFINAL && (!end || reader->bp < end))
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    if(reader->bp + 2 >= reader->bitsize) return 52; /*error, bit pointer will jump past memory*/
+    BFINAL = BitReader_readBits(reader, 1);
+    BTYPE = BitReader_readBits(reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, reader, &pos, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
+
+    if(sink && pos >= INFLATE_FLUSH_SIZE)
+    {
+      size_t done = pos - INFLATE_WINDOW_SIZE;
+      error = sink->write(sink->user, out->data, done);
+      if(error) return error;
+      memmove(out->data, out->data + done, INFLATE_WINDOW_SIZE);
+      pos = INFLATE_WINDOW_SIZE;
+      out->size = pos;
+    }
   }
 
+  /*a band must end where the next one starts, without a final block*/
+  if(end && (BFINAL || reader->bp != end)) return 95;
+
+  if(sink && pos > 0) error = sink->write(sink->user, out->data, pos);
+
   return error;
 }
 
+/*
+If sink is null, the whole decompressed data is left in out. Otherwise it is handed to the sink in
+pieces as it is inflated, and out only ever holds the window plus the output of one block.
+*/
+static unsigned lodepng_inflatev(ucvector* out, BitReader* reader,
+                                 const LodePNGDecompressSettings* settings,
+                                 const InflateSink* sink)
+{
+  (void)settings;
+  return inflateBlocks(out, reader, sink, 0);
+}
+
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings)
 {
   unsigned error;
   ucvector v;
+  BitReader reader;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_inflatev(&v, in, insize, settings);
+  BitReader_init(&reader, in, insize);
+  error = lodepng_inflatev(&v, &reader, settings, 0);
   *out = v.data;
   *outsize = v.size;
   return error;
 }
 
-static unsigned inflate(unsigned char** out, size_t* outsize,
-                        const unsigned char* in, size_t insize,
-                        const LodePNGDecompressSettings* settings)
+/*
+Inflates with the custom or built-in inflate. out keeps its allocation: if the caller reserved the
+decompressed size beforehand, the built-in inflate writes into that buffer without allocating again.
+*/
+static unsigned inflate_into(ucvector* out, const unsigned char* in, size_t insize,
+                             const LodePNGDecompressSettings* settings)
 {
   if(settings->custom_inflate)
   {
-    return settings->custom_inflate(out, outsize, in, insize, settings);
+    unsigned error = settings->custom_inflate(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
   }
   else
   {
-    return lodepng_inflate(out, outsize, in, insize, settings);
+    BitReader reader;
+    BitReader_init(&reader, in, insize);
+    return lodepng_inflatev(out, &reader, settings, 0);
   }
 }
 
@@ -1462,6 +1903,30 @@ static void updateHashChain(Hash* hash, size_t wpos, unsigned hashval, unsigned
   hash->headz[numzeros] = wpos;
 }
 
+/*
+Enters the window of bytes before pos into the hash chains, as encodeLZ77 enters the bytes it passes,
+so that data compressed on its own from pos can still match the data before it. (Local addition)
+*/
+static void hash_prime(Hash* hash, const unsigned char* in, size_t pos, unsigned windowsize)
+{
+  size_t i = pos > windowsize ? pos - windowsize : 0;
+  unsigned hashval, numzeros = 0;
+  for(; i < pos; ++i)
+  {
+    hashval = getHash(in, pos, i);
+    if(hashval == 0)
+    {
+      if(numzeros == 0) numzeros = countZeros(in, pos, i);
+      else if(i + numzeros > pos || in[i + numzeros - 1] != 0) --numzeros;
+    }
+    else
+    {
+      numzeros = 0;
+    }
+    updateHashChain(hash, i & (windowsize - 1), hashval, (unsigned short)numzeros);
+  }
+}
+
 /*
 LZ77-encode the data. Return value is error code. The input are raw bytes, the output
 is in the form of unsigned integers with codes representing for example literal bytes, or
@@ -1650,7 +2115,7 @@ static unsigned encodeLZ77(uivector* out, Hash* hash,
 
 /* /////////////////////////////////////////////////////////////////////////// */
 
-static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize)
+static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, size_t datasize, unsigned final)
 {
   /*non compressed deflate block data: 1 bit BFINAL,2 bits BTYPE,(5 bits): it jumps to start of next byte,
   2 bytes LEN, 2 bytes NLEN, LEN bytes literal DATA*/
@@ -1662,7 +2127,7 @@ static unsigned deflateNoCompression(ucvector* out, const unsigned char* data, s
     unsigned BFINAL, BTYPE, LEN, NLEN;
     unsigned char firstbyte;
 
-    BFINAL = (i == numdeflateblocks - 1);
+    BFINAL = final && (i == numdeflateblocks - 1);
     BTYPE = 0;
 
     firstbyte = (unsigned char)(BFINAL + ((BTYPE & 1) << 1) + ((BTYPE & 2) << 1));
@@ -2014,16 +2479,124 @@ static unsigned deflateFixed(ucvector* out, size_t* bp, Hash* hash,
   return error;
 }
 
+/*
+Ends a deflate stream that more data will follow with an empty stored block, so that it stops at a
+byte boundary and the data after it can be inflated without it once its matches don't reach back
+(a full flush, as zlib calls it). bp is the bit pointer of out, which must be at the end of out.
+(Local addition, not part of upstream LodePNG.)
+*/
+static void deflateFullFlush(ucvector* out, size_t* bp)
+{
+  addBitsToStream(bp, out, 0, 3); /*BFINAL 0 and BTYPE 00, the rest of the byte is padding*/
+  ucvector_push_back(out, 0); /*LEN 0*/
+  ucvector_push_back(out, 0);
+  ucvector_push_back(out, 255); /*NLEN*/
+  ucvector_push_back(out, 255);
+}
+
+/*
+Deflates in[start, end) onto the end of out as blocks of blocksize, with its own hash primed with the
+window before start, so that matches may still reach back into it. Unless final, no block is marked
+final and it ends with a full flush, so that it stops at a byte boundary. (Local addition)
+*/
+static unsigned deflateChunk(ucvector* out, const unsigned char* in, size_t start, size_t end,
+                             size_t blocksize, const LodePNGCompressSettings* settings, unsigned final)
+{
+  unsigned error;
+  size_t bp = 0; /*the bit pointer*/
+  Hash hash;
+
+  error = hash_init(&hash, settings->windowsize);
+  if(!error) hash_prime(&hash, in, start, settings->windowsize);
+
+  /*there is always at least one block, even if it is empty*/
+  while(!error)
+  {
+    size_t blockend = end - start > blocksize ? start + blocksize : end;
+    unsigned last = final && blockend == end;
+
+    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, blockend, settings, last);
+    else /*if(settings->btype == 2)*/ error = deflateDynamic(out, &bp, &hash, in, start, blockend, settings, last);
+
+    start = blockend;
+    if(start == end) break;
+  }
+  if(!error && !final) deflateFullFlush(out, &bp);
+
+  hash_cleanup(&hash);
+
+  return error;
+}
+
+/*Least amount of data lodepng_deflatev deflates independently when settings->threads isn't 1 (Local addition)*/
+static const size_t DEFLATE_CHUNK_SIZE = 262144;
+
+#ifdef LODEPNG_COMPILE_CPP
+/*
+Deflates the chunks of chunksize bytes of in on several threads, each onto its own vector, then appends
+the vectors to out in order. (Local addition)
+*/
+static unsigned deflateChunksParallel(ucvector* out, const unsigned char* in, size_t insize,
+                                      size_t chunksize, size_t blocksize,
+                                      const LodePNGCompressSettings* settings, unsigned final)
+{
+  size_t numchunks = (insize + chunksize - 1) / chunksize;
+  std::vector<ucvector> chunks(numchunks);
+  std::vector<unsigned> errors(numchunks, 0);
+  std::atomic<size_t> next(0);
+  std::atomic<bool> failed(false);
+  size_t i, pos = out->size, total = 0;
+  unsigned error = 0;
+
+  for(i = 0; i != numchunks; ++i) ucvector_init(&chunks[i]);
+  lodepng_run_threads(std::min<size_t>(settings->threads, numchunks), [&]()
+  {
+    for(size_t chunk = next++; chunk < numchunks && !failed; chunk = next++)
+    {
+      size_t start = chunk * chunksize;
+      size_t end = insize - start > chunksize ? start + chunksize : insize;
+      errors[chunk] = deflateChunk(&chunks[chunk], in, start, end, blocksize, settings, final && end == insize);
+      if(errors[chunk]) failed = true;
+    }
+  });
+
+  for(i = 0; i != numchunks && !error; ++i)
+  {
+    error = errors[i];
+    total += chunks[i].size;
+  }
+  if(!error && !ucvector_resize(out, pos + total)) error = 83; /*alloc fail*/
+  for(i = 0; i != numchunks && !error; ++i)
+  {
+    if(chunks[i].size) memcpy(out->data + pos, chunks[i].data, chunks[i].size);
+    pos += chunks[i].size;
+  }
+  for(i = 0; i != numchunks; ++i) ucvector_cleanup(&chunks[i]);
+
+  return error;
+}
+#endif /*LODEPNG_COMPILE_CPP*/
+
+/*
+Deflates in onto the end of out. If final is 0, the stream is left open for more data: no block is
+marked final and it ends with a full flush (Local addition, not part of upstream LodePNG).
+With settings->threads other than 1, it is deflated in chunks of whole blocks, as deflateChunk does,
+and on several threads if compiled as C++ (Local addition).
+*/
 static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t insize,
-                                 const LodePNGCompressSettings* settings)
+                                 const LodePNGCompressSettings* settings, unsigned final)
 {
   unsigned error = 0;
-  size_t i, blocksize, numdeflateblocks;
+  size_t blocksize, chunksize, start;
   size_t bp = 0; /*the bit pointer*/
-  Hash hash;
 
   if(settings->btype > 2) return 61;
-  else if(settings->btype == 0) return deflateNoCompression(out, in, insize);
+  else if(settings->btype == 0)
+  {
+    error = deflateNoCompression(out, in, insize, final);
+    if(!error && !final) deflateFullFlush(out, &bp);
+    return error;
+  }
   else if(settings->btype == 1) blocksize = insize;
   else /*if(settings->btype == 2)*/
   {
@@ -2033,25 +2606,22 @@ static unsigned lodepng_deflatev(ucvector* out, const unsigned char* in, size_t
     if(blocksize > 262144) blocksize = 262144;
   }
 
-  numdeflateblocks = (insize + blocksize - 1) / blocksize;
-  if(numdeflateblocks == 0) numdeflateblocks = 1;
-
-  error = hash_init(&hash, settings->windowsize);
-  if(error) return error;
-
-  for(i = 0; i != numdeflateblocks && !error; ++i)
+  if(settings->threads == 1 || insize <= DEFLATE_CHUNK_SIZE)
   {
-    unsigned final = (i == numdeflateblocks - 1);
-    size_t start = i * blocksize;
-    size_t end = start + blocksize;
-    if(end > insize) end = insize;
-
-    if(settings->btype == 1) error = deflateFixed(out, &bp, &hash, in, start, end, settings, final);
-    else if(settings->btype == 2) error = deflateDynamic(out, &bp, &hash, in, start, end, settings, final);
+    return deflateChunk(out, in, 0, insize, blocksize, settings, final);
   }
+  /*whole blocks of at least DEFLATE_CHUNK_SIZE, so the chunks don't depend on the number of threads*/
+  chunksize = (DEFLATE_CHUNK_SIZE + blocksize - 1) / blocksize * blocksize;
 
-  hash_cleanup(&hash);
-
+#ifdef LODEPNG_COMPILE_CPP
+  if(insize > chunksize) return deflateChunksParallel(out, in, insize, chunksize, blocksize, settings, final);
+#endif /*LODEPNG_COMPILE_CPP*/
+  for(start = 0; !error; start += chunksize)
+  {
+    size_t end = insize - start > chunksize ? start + chunksize : insize;
+    error = deflateChunk(out, in, start, end, blocksize, settings, final && end == insize);
+    if(end == insize) break;
+  }
   return error;
 }
 
@@ -2062,7 +2632,7 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_deflatev(&v, in, insize, settings);
+  error = lodepng_deflatev(&v, in, insize, settings, 1);
   *out = v.data;
   *outsize = v.size;
   return error;
@@ -2088,11 +2658,69 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_X86_DISPATCH
+/*
+Adds the whole 32-byte blocks of data to the sums s1 and s2, returning how many bytes it used.
+(Local addition, not part of upstream LodePNG.) Over a block starting with sums s1 and s2, s1 gains
+the sum of the bytes, and s2 gains 32 * s1 plus each byte weighted by 32 down to 1 for its position:
+_mm256_sad_epu8 adds the bytes, and _mm256_maddubs_epi16 then _mm256_madd_epi16 the weighted bytes.
+The 32 * s1 terms are collected in ps, and the sums reduced mod 65521 every 173 blocks (5536 bytes),
+before the 32-bit lanes can overflow.
+*/
+__attribute__((target("avx2")))
+static unsigned adler32AVX2(unsigned* s1, unsigned* s2, const unsigned char* data, unsigned len)
+{
+  const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                           16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i zero = _mm256_setzero_si256();
+  unsigned blocks = len / 32;
+  unsigned done = blocks * 32;
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : blocks;
+    __m256i v1 = zero, v2 = zero, ps = zero;
+    __m128i sum1, sum2;
+    blocks -= n;
+    *s2 += *s1 * 32 * n;
+    for(; n > 0; --n, data += 32)
+    {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      ps = _mm256_add_epi32(ps, v1);
+      v1 = _mm256_add_epi32(v1, _mm256_sad_epu8(bytes, zero));
+      v2 = _mm256_add_epi32(v2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+    }
+    v2 = _mm256_add_epi32(v2, _mm256_slli_epi32(ps, 5));
+
+    /*add up the eight 32-bit lanes of each sum*/
+    sum1 = _mm_add_epi32(_mm256_castsi256_si128(v1), _mm256_extracti128_si256(v1, 1));
+    sum2 = _mm_add_epi32(_mm256_castsi256_si128(v2), _mm256_extracti128_si256(v2, 1));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+    *s1 = (*s1 + (unsigned)_mm_cvtsi128_si32(sum1)) % 65521;
+    *s2 = (*s2 + (unsigned)_mm_cvtsi128_si32(sum2)) % 65521;
+  }
+  return done;
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
    unsigned s1 = adler & 0xffff;
    unsigned s2 = (adler >> 16) & 0xffff;
 
+#ifdef LODEPNG_X86_DISPATCH
+  if(len >= 32 && __builtin_cpu_supports("avx2"))
+  {
+    unsigned done = adler32AVX2(&s1, &s2, data, len);
+    data += done;
+    len -= done;
+  }
+#endif /*LODEPNG_X86_DISPATCH*/
+
   while(len > 0)
   {
     /*at least 5550 sums can be done before the sums overflow, saving a lot of module divisions*/
@@ -2117,16 +2745,37 @@ static unsigned adler32(const unsigned char* data, unsigned len)
   return update_adler32(1L, data, len);
 }
 
+#if defined(LODEPNG_COMPILE_DECODER) && defined(LODEPNG_COMPILE_CPP)
+/*
+Returns the adler32 of two pieces of data one after the other, from the adler32 of each and the
+length of the second, as zlib's adler32_combine does. (Local addition, not part of upstream LodePNG.)
+*/
+static unsigned adler32_combine(unsigned adler1, unsigned adler2, size_t len2)
+{
+  /*s1 adds up the bytes plus 1, and s2 the s1 after every byte: the first piece's s1 minus 1
+  goes into s2 once for every byte of the second*/
+  unsigned rem = (unsigned)(len2 % 65521);
+  unsigned s1 = adler1 & 0xffff;
+  unsigned s2 = (unsigned)(((unsigned long long)rem * s1) % 65521);
+  s1 += (adler2 & 0xffff) + 65521 - 1;
+  s2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + 65521 - rem;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s1 >= 65521) s1 -= 65521;
+  if(s2 >= 2 * 65521) s2 -= 2 * 65521;
+  if(s2 >= 65521) s2 -= 65521;
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_DECODER && LODEPNG_COMPILE_CPP*/
+
 /* ////////////////////////////////////////////////////////////////////////// */
 /* / Zlib                                                                   / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*checks the 2-byte zlib header, returns error code*/
+static unsigned zlib_check_header(const unsigned char* in, size_t insize)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2155,32 +2804,160 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
     return 26;
   }
 
-  error = inflate(out, outsize, in + 2, insize - 2, settings);
+  return 0;
+}
+
+/*lodepng_zlib_decompress into a ucvector, which keeps its allocation (see inflate_into)*/
+static unsigned lodepng_zlib_decompressv(ucvector* out, const unsigned char* in, size_t insize,
+                                         const LodePNGDecompressSettings* settings)
+{
+  unsigned error = zlib_check_header(in, insize);
+  if(error) return error;
+
+  error = inflate_into(out, in + 2, insize - 2, settings);
   if(error) return error;
 
   if(!settings->ignore_adler32)
   {
     unsigned ADLER32 = lodepng_read32bitInt(&in[insize - 4]);
-    unsigned checksum = adler32(*out, (unsigned)(*outsize));
+    unsigned checksum = adler32(out->data, (unsigned)(out->size));
     if(checksum != ADLER32) return 58; /*error, adler checksum not correct, data must be corrupted*/
   }
 
   return 0; /*no error*/
 }
 
-static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                size_t insize, const LodePNGDecompressSettings* settings)
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
 {
-  if(settings->custom_zlib)
-  {
-    return settings->custom_zlib(out, outsize, in, insize, settings);
-  }
+  unsigned error;
+  ucvector v;
+  ucvector_init_buffer(&v, *out, *outsize);
+  error = lodepng_zlib_decompressv(&v, in, insize, settings);
+  *out = v.data;
+  *outsize = v.size;
+  return error;
+}
+
+static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                size_t insize, const LodePNGDecompressSettings* settings)
+{
+  if(settings->custom_zlib)
+  {
+    return settings->custom_zlib(out, outsize, in, insize, settings);
+  }
   else
   {
     return lodepng_zlib_decompress(out, outsize, in, insize, settings);
   }
 }
 
+/*
+zlib_decompress into a ucvector that keeps its allocation, so the whole output can be reserved up
+front when its size is known. A custom zlib function gets the buffer as zlib_decompress would pass it.
+*/
+static unsigned zlib_decompress_into(ucvector* out, const unsigned char* in, size_t insize,
+                                     const LodePNGDecompressSettings* settings)
+{
+  if(settings->custom_zlib)
+  {
+    unsigned error = settings->custom_zlib(&out->data, &out->size, in, insize, settings);
+    out->allocsize = out->size;
+    return error;
+  }
+  return lodepng_zlib_decompressv(out, in, insize, settings);
+}
+
+/*Forwards inflated data to another sink while keeping a running Adler-32 of it*/
+typedef struct AdlerSink
+{
+  const InflateSink* next;
+  unsigned adler;
+} AdlerSink;
+
+static unsigned adlerSinkWrite(void* user, const unsigned char* data, size_t size)
+{
+  AdlerSink* sink = (AdlerSink*)user;
+  sink->adler = update_adler32(sink->adler, data, (unsigned)size);
+  return sink->next->write(sink->next->user, data, size);
+}
+
+/*
+The built-in zlib decompressor, reading the stream from the start of reader, which may be split into
+segments. Without a sink, the data is left in out, which keeps its allocation (see inflate_into).
+With a sink, it is handed over in pieces as in zlib_decompress_stream, and out is not used.
+*/
+static unsigned zlib_decompress_reader(ucvector* out, BitReader* reader,
+                                       const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  size_t insize = reader->bitsize / 8;
+  unsigned char header[2] = {0, 0};
+  unsigned char checksum[4];
+  unsigned adler;
+  unsigned error;
+
+  /*with fewer than 2 bytes, zlib_check_header fails on the size without looking at the bytes*/
+  if(insize >= 2) BitReader_readBytes(reader, header, 0, 2);
+  error = zlib_check_header(header, insize);
+  if(error) return error;
+
+  if(sink)
+  {
+    ucvector window;
+    AdlerSink adler_sink;
+    InflateSink checked;
+
+    adler_sink.next = sink;
+    adler_sink.adler = 1;
+    checked.write = adlerSinkWrite;
+    checked.user = &adler_sink;
+
+    ucvector_init(&window);
+    if(!ucvector_reserve(&window, INFLATE_FLUSH_SIZE)) return 83; /*alloc fail*/
+    error = lodepng_inflatev(&window, reader, settings, &checked);
+    ucvector_cleanup(&window);
+    adler = adler_sink.adler;
+  }
+  else
+  {
+    error = lodepng_inflatev(out, reader, settings, 0);
+    if(!error && !settings->ignore_adler32) adler = adler32(out->data, (unsigned)(out->size));
+  }
+  if(error) return error;
+
+  if(!settings->ignore_adler32)
+  {
+    BitReader_readBytes(reader, checksum, insize - 4, 4);
+    if(adler != lodepng_read32bitInt(checksum)) return 58; /*error, adler checksum not correct, data must be corrupted*/
+  }
+
+  return 0; /*no error*/
+}
+
+/*
+Same as zlib_decompress, but hands the decompressed data to sink in pieces instead of returning
+it in one buffer, so the whole decompressed stream never has to be in memory at once. With a
+custom zlib or inflate function the data is decompressed in full and then handed over at once.
+*/
+static unsigned zlib_decompress_stream(const unsigned char* in, size_t insize,
+                                       const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  BitReader reader;
+
+  if(settings->custom_zlib || settings->custom_inflate)
+  {
+    unsigned char* out = 0;
+    size_t outsize = 0;
+    unsigned error = zlib_decompress(&out, &outsize, in, insize, settings);
+    if(!error) error = sink->write(sink->user, out, outsize);
+    lodepng_free(out);
+    return error;
+  }
+
+  BitReader_init(&reader, in, insize);
+  return zlib_decompress_reader(0, &reader, settings, sink);
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2240,6 +3017,33 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
   }
 }
 
+/*
+zlib-compresses in into out, which must be empty, as bands of bandsize bytes (the last may be shorter).
+Each band is deflated as if it were the whole input and ends with a full flush, so that it can be
+inflated without the bands before it. offsets receives the position in out of every band but the
+first, which starts right after the header. (Local addition, not part of upstream LodePNG.)
+*/
+static unsigned zlib_compress_bands(ucvector* out, uivector* offsets, const unsigned char* in, size_t insize,
+                                    size_t bandsize, const LodePNGCompressSettings* settings)
+{
+  unsigned error = 0;
+  size_t start;
+
+  /*the header lodepng_zlib_compress writes: CM 8, CINFO 7, no preset dictionary*/
+  ucvector_push_back(out, 120);
+  ucvector_push_back(out, 1);
+
+  for(start = 0; start < insize && !error; start += bandsize)
+  {
+    size_t size = insize - start < bandsize ? insize - start : bandsize;
+    if(start != 0 && !uivector_push_back(offsets, (unsigned)out->size)) return 83; /*alloc fail*/
+    error = lodepng_deflatev(out, &in[start], size, settings, start + size == insize);
+  }
+
+  if(!error) lodepng_add32bitInt(out, adler32(in, (unsigned)insize));
+  return error;
+}
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #else /*no LODEPNG_COMPILE_ZLIB*/
@@ -2251,6 +3055,32 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
+
+static unsigned zlib_decompress_into(ucvector* out, const unsigned char* in, size_t insize,
+                                     const LodePNGDecompressSettings* settings)
+{
+  unsigned error = zlib_decompress(&out->data, &out->size, in, insize, settings);
+  out->allocsize = out->size;
+  return error;
+}
+
+typedef struct InflateSink
+{
+  unsigned (*write)(void* user, const unsigned char* data, size_t size);
+  void* user;
+} InflateSink;
+
+/*without the built-in inflate there is nothing to stream: decompress in full and hand it over at once*/
+static unsigned zlib_decompress_stream(const unsigned char* in, size_t insize,
+                                       const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  unsigned char* out = 0;
+  size_t outsize = 0;
+  unsigned error = zlib_decompress(&out, &outsize, in, insize, settings);
+  if(!error) error = sink->write(sink->user, out, outsize);
+  lodepng_free(out);
+  return error;
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 #ifdef LODEPNG_COMPILE_ENCODER
 static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsigned char* in,
@@ -2279,13 +3109,14 @@ void lodepng_compress_settings_init(LodePNGCompressSettings* settings)
   settings->minmatch = 3;
   settings->nicematch = 128;
   settings->lazymatching = 1;
+  settings->threads = 1;
 
   settings->custom_zlib = 0;
   settings->custom_deflate = 0;
   settings->custom_context = 0;
 }
 
-const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 0, 0, 0};
+const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT_WINDOWSIZE, 3, 128, 1, 1, 0, 0, 0};
 
 
 #endif /*LODEPNG_COMPILE_ENCODER*/
@@ -2320,51 +3151,393 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 #ifndef LODEPNG_NO_COMPILE_CRC
 /* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
-           0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
-   249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
-   498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
-   325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
-   997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
-   901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
-   651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
-   671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
-  1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
-  2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
-  1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
-  1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
-  1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
-  1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
-  1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
-  1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
-  3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
-  3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
-  4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
-  4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
-  3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
-  3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
-  3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
-  3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
-  2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
-  2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
-  2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
-  2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
-  2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
-  2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
-  3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
-  3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+/*
+lodepng_crc32_table[0] is the usual byte-at-a-time table; table k gives the CRC of a byte followed
+by k zero bytes, so eight bytes can be folded in with one lookup each (slicing-by-8).
+(Local addition, not part of upstream LodePNG, which only has the first table.)
+*/
+static const unsigned lodepng_crc32_table[8][256] = {
+  {
+             0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
+     249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
+     498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
+     325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
+     997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
+     901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
+     651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
+     671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
+    1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
+    2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
+    1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
+    1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
+    1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
+    1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
+    1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
+    1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
+    3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
+    3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
+    4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
+    4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
+    3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+    3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
+    3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
+    3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
+    2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
+    2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
+    2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
+    2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
+    2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
+    2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
+    3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
+    3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+  },
+  {
+             0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+    3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+    1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+    2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+    2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+    1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+    3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+     396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+    4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+     950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+    3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+    1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+    1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+    2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+     792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+    3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+     998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+    4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+    1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+    3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+    2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+    1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+    3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+     740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+    3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+      52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+    2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+    1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+    1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+    2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+     347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+    3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+  },
+  {
+             0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+     236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+     472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+     305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+     944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+     912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+     611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+     712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+    1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+    2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+    1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+    1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+    1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+    1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+    1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+    1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+    3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+    4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+    4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+    4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+    3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+    3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+    3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+    3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+    2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+    2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+    2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+    2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+    2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+    2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+    3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+    3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+             0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+    3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+    1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+    2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+    2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+    1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+    4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+     899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+    2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+    1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+    3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+     247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+     992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+    4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+    1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+    2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+    3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+     686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+    3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+    2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+    1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+    2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+     494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+    3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+    1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+    3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+     643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+    3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+    3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+     332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+    2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+    1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+             0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+     812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+    1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+    1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+    3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+    4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+    2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+    2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+    1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+    1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+     940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+     140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+    2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+    2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+    4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+    3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+    2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+    2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+    3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+    3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+    1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+    1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+     281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+     548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+    3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+    3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+    2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+    3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+     685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+     413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+    1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+    2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+  },
+  {
+             0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+    3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+      64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+    4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+     128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+    3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+      75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+    3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+     257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+    3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+     210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+    3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+     150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+    3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+     186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+    3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+     514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+    4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+     493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+    4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+     421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+    4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+     449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+    4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+     300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+    4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+     306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+    4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+     373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+    4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+     361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+    4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+  },
+  {
+             0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+     871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+    1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+    1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+    3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+    4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+    2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+    2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+    1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+    2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+     601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+     272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+    2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+    3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+    3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+    3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+    2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+    3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+    4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+    3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+    1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+    1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+     544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+     328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+    3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+    4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+    2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+    2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+      60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+     810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+    1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+    1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+  },
+  {
+             0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+    3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+    2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+    2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+    4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+     714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+    2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+    1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+     698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+    4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+    1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+    2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+    3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+      51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+    2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+    2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+    1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+    2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+     796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+    4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+    2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+    2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+    3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+      85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+    2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+    2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+     102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+    3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+    2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+    1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+    4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+     747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+  }
 };
 
-/*Return the CRC of the bytes buf[0..len-1].*/
+/*updates the CRC register r, before the final inversion, with length bytes, eight at a time*/
+static unsigned crc32Slice8(unsigned r, const unsigned char* data, size_t length)
+{
+  for(; length >= 8; data += 8, length -= 8)
+  {
+    unsigned one = r ^ (data[0] | (unsigned)data[1] << 8 | (unsigned)data[2] << 16 | (unsigned)data[3] << 24);
+    unsigned two = data[4] | (unsigned)data[5] << 8 | (unsigned)data[6] << 16 | (unsigned)data[7] << 24;
+    r = lodepng_crc32_table[7][one & 0xff] ^ lodepng_crc32_table[6][(one >> 8) & 0xff]
+      ^ lodepng_crc32_table[5][(one >> 16) & 0xff] ^ lodepng_crc32_table[4][one >> 24]
+      ^ lodepng_crc32_table[3][two & 0xff] ^ lodepng_crc32_table[2][(two >> 8) & 0xff]
+      ^ lodepng_crc32_table[1][(two >> 16) & 0xff] ^ lodepng_crc32_table[0][two >> 24];
+  }
+  for(; length > 0; ++data, --length)
+  {
+    r = lodepng_crc32_table[0][(r ^ *data) & 0xff] ^ (r >> 8);
+  }
+  return r;
+}
+
+#ifdef LODEPNG_X86_DISPATCH
+/*
+Updates the CRC register r with length bytes using carry-less multiplication, following Intel's
+"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction": four 128-bit lanes are
+folded 64 bytes at a time, then into one lane, which is folded 16 bytes at a time and finally
+reduced to 32 bits with a Barrett reduction. length must be a multiple of 16 and at least 64.
+(Local addition, not part of upstream LodePNG.)
+*/
+__attribute__((target("sse2,pclmul")))
+static unsigned crc32Pclmul(unsigned r, const unsigned char* data, size_t length)
+{
+  /*the folding and Barrett constants the paper gives for the bit-reflected polynomial 0xedb88320*/
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+  const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124LL);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+  const __m128i low32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x1, x2, x3, x4, t;
+
+  x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + 0)), _mm_cvtsi32_si128((int)r));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+  data += 64;
+  length -= 64;
+
+  for(; length >= 64; data += 64, length -= 64)
+  {
+    __m128i t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    __m128i t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    __m128i t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    __m128i t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x11), t1);
+    x2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x11), t2);
+    x3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x11), t3);
+    x4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x11), t4);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)(data + 0)));
+    x2 = _mm_xor_si128(x2, _mm_loadu_si128((const __m128i*)(data + 16)));
+    x3 = _mm_xor_si128(x3, _mm_loadu_si128((const __m128i*)(data + 32)));
+    x4 = _mm_xor_si128(x4, _mm_loadu_si128((const __m128i*)(data + 48)));
+  }
+
+  /*fold the four lanes into x1, then the remaining 16-byte blocks*/
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), t);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), t);
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), t);
+  for(; length >= 16; data += 16, length -= 16)
+  {
+    t = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), t);
+    x1 = _mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data));
+  }
+
+  /*fold 128 bits to 64*/
+  t = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+  t = _mm_srli_si128(x1, 4);
+  x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), t);
+
+  /*Barrett reduction to 32 bits*/
+  t = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+  t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+  x1 = _mm_xor_si128(x1, t);
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
+/*
+Return the CRC of the bytes buf[0..len-1]. Long buffers go through crc32Pclmul on x86 CPUs that
+have carry-less multiplication, the rest through slicing-by-8; both give the same result as the
+byte-at-a-time loop.
+*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+#ifdef LODEPNG_X86_DISPATCH
+  if(length >= 64 && __builtin_cpu_supports("pclmul"))
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    size_t folded = length & ~(size_t)15;
+    r = crc32Pclmul(r, data, folded);
+    data += folded;
+    length -= folded;
   }
-  return r ^ 0xffffffffu;
+#endif /*LODEPNG_X86_DISPATCH*/
+  return crc32Slice8(r, data, length) ^ 0xffffffffu;
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
@@ -3968,6 +5141,118 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_X86_DISPATCH
+/*
+SSE2 unfilter loops, picked at runtime by unfilterScanline, which finishes whatever bytes they leave
+with its scalar loops. (Local addition, not part of upstream LodePNG.) Each returns how many bytes
+of the scanline it reconstructed. Like the scalar loops, they read each input byte before writing
+the output byte at the same position, so recon and scanline may be the same memory.
+Up works for any pixel size; the others take 4-byte pixels (RGBA, or 16-bit gray with alpha). Sub
+runs a prefix sum over four pixels at a time. Average and Paeth depend on the reconstructed pixel to
+their left, so they do one pixel per step with its four channels in parallel.
+*/
+__attribute__((target("sse2")))
+static __m128i unfilterLoad4(const unsigned char* p)
+{
+  int v;
+  memcpy(&v, p, 4);
+  return _mm_cvtsi32_si128(v);
+}
+
+__attribute__((target("sse2")))
+static void unfilterStore4(unsigned char* p, __m128i x)
+{
+  int v = _mm_cvtsi128_si32(x);
+  memcpy(p, &v, 4);
+}
+
+__attribute__((target("sse2")))
+static __m128i unfilterAbs16(__m128i x)
+{
+  return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+__attribute__((target("sse2")))
+static size_t unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                             size_t length)
+{
+  size_t i;
+  for(i = 0; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+    _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t unfilterSub4SSE2(unsigned char* recon, const unsigned char* scanline, size_t length)
+{
+  __m128i last = _mm_setzero_si128(); /*the previous reconstructed pixel, in all four lanes*/
+  size_t i;
+  for(i = 0; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+    x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+    x = _mm_add_epi8(x, last);
+    _mm_storeu_si128((__m128i*)(recon + i), x);
+    last = _mm_shuffle_epi32(x, 0xFF);
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t unfilterAverage4SSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                   size_t length)
+{
+  __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128(); /*the pixel to the left; 0 left of the first one*/
+  size_t i;
+  for(i = 0; i + 4 <= length; i += 4)
+  {
+    __m128i b = unfilterLoad4(precon + i);
+    /*_mm_avg_epu8 rounds up where the filter rounds down, which differs when a + b is odd*/
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(unfilterLoad4(scanline + i), average);
+    unfilterStore4(recon + i, a);
+  }
+  return i;
+}
+
+__attribute__((target("sse2")))
+static size_t unfilterPaeth4SSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                 size_t length)
+{
+  /*a, b and c as in paethPredictor, widened to 16 bits; a and c are 0 left of the first pixel*/
+  __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i + 4 <= length; i += 4)
+  {
+    __m128i b = _mm_unpacklo_epi8(unfilterLoad4(precon + i), zero);
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = unfilterAbs16(_mm_add_epi16(pa, pb));
+    __m128i smallest, use_a, use_b, predictor;
+    pa = unfilterAbs16(pa);
+    pb = unfilterAbs16(pb);
+    smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    /*same choice as paethPredictor: a if pa is smallest, else b if pb is, else c*/
+    use_a = _mm_cmpeq_epi16(pa, smallest);
+    use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(pb, smallest));
+    predictor = _mm_or_si128(_mm_or_si128(_mm_and_si128(use_a, a), _mm_and_si128(use_b, b)),
+                             _mm_andnot_si128(_mm_or_si128(use_a, use_b), c));
+    a = _mm_add_epi8(unfilterLoad4(scanline + i), _mm_packus_epi16(predictor, predictor));
+    unfilterStore4(recon + i, a);
+    a = _mm_unpacklo_epi8(a, zero);
+    c = b;
+  }
+  return i;
+}
+#endif /*LODEPNG_X86_DISPATCH*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -3980,20 +5265,33 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   recon and scanline MAY be the same memory address! precon must be disjoint.
   */
 
-  size_t i;
+  /*
+  i starts past whatever a vectorized loop already did. Those stop at a whole number of pixels and
+  do either nothing or at least the first pixel, so each first-pixel loop below runs fully or not at all.
+  */
+  size_t i = 0;
+#ifdef LODEPNG_X86_DISPATCH
+  int sse2 = __builtin_cpu_supports("sse2");
+#endif /*LODEPNG_X86_DISPATCH*/
   switch(filterType)
   {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
       break;
     case 1:
-      for(i = 0; i != bytewidth; ++i) recon[i] = scanline[i];
-      for(i = bytewidth; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
+#ifdef LODEPNG_X86_DISPATCH
+      if(sse2 && bytewidth == 4) i = unfilterSub4SSE2(recon, scanline, length);
+#endif /*LODEPNG_X86_DISPATCH*/
+      for(; i < bytewidth; ++i) recon[i] = scanline[i];
+      for(; i < length; ++i) recon[i] = scanline[i] + recon[i - bytewidth];
       break;
     case 2:
       if(precon)
       {
-        for(i = 0; i != length; ++i) recon[i] = scanline[i] + precon[i];
+#ifdef LODEPNG_X86_DISPATCH
+        if(sse2) i = unfilterUpSSE2(recon, scanline, precon, length);
+#endif /*LODEPNG_X86_DISPATCH*/
+        for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
       }
       else
       {
@@ -4003,8 +5301,11 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     case 3:
       if(precon)
       {
-        for(i = 0; i != bytewidth; ++i) recon[i] = scanline[i] + (precon[i] >> 1);
-        for(i = bytewidth; i < length; ++i) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) >> 1);
+#ifdef LODEPNG_X86_DISPATCH
+        if(sse2 && bytewidth == 4) i = unfilterAverage4SSE2(recon, scanline, precon, length);
+#endif /*LODEPNG_X86_DISPATCH*/
+        for(; i < bytewidth; ++i) recon[i] = scanline[i] + (precon[i] >> 1);
+        for(; i < length; ++i) recon[i] = scanline[i] + ((recon[i - bytewidth] + precon[i]) >> 1);
       }
       else
       {
@@ -4015,22 +5316,29 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
     case 4:
       if(precon)
       {
-        for(i = 0; i != bytewidth; ++i)
+#ifdef LODEPNG_X86_DISPATCH
+        if(sse2 && bytewidth == 4) i = unfilterPaeth4SSE2(recon, scanline, precon, length);
+#endif /*LODEPNG_X86_DISPATCH*/
+        for(; i < bytewidth; ++i)
         {
           recon[i] = (scanline[i] + precon[i]); /*paethPredictor(0, precon[i], 0) is always precon[i]*/
         }
-        for(i = bytewidth; i < length; ++i)
+        for(; i < length; ++i)
         {
           recon[i] = (scanline[i] + paethPredictor(recon[i - bytewidth], precon[i], precon[i - bytewidth]));
         }
       }
       else
       {
-        for(i = 0; i != bytewidth; ++i)
+#ifdef LODEPNG_X86_DISPATCH
+        /*paethPredictor(recon[i - bytewidth], 0, 0) is always recon[i - bytewidth], as for Sub*/
+        if(sse2 && bytewidth == 4) i = unfilterSub4SSE2(recon, scanline, length);
+#endif /*LODEPNG_X86_DISPATCH*/
+        for(; i < bytewidth; ++i)
         {
           recon[i] = scanline[i];
         }
-        for(i = bytewidth; i < length; ++i)
+        for(; i < length; ++i)
         {
           /*paethPredictor(recon[i - bytewidth], 0, 0) is always recon[i - bytewidth]*/
           recon[i] = (scanline[i] + recon[i - bytewidth]);
@@ -4520,19 +5828,16 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*read the chunks of a PNG into state and collect the data of its IDAT chunks, in place in the PNG,
+into idat, which must be initialized. If restarts isn't null, it receives the rsPT chunk, or null if
+there is none (see restart_rows in LodePNGEncoderSettings). On error state->error is set.*/
+static void readImageChunks(segvector* idat, const unsigned char** restarts, unsigned* w, unsigned* h,
+                            LodePNGState* state,
+                            const unsigned char* in, size_t insize)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
-  size_t i;
-  ucvector idat; /*the data from idat chunks*/
-  ucvector scanlines;
-  size_t predict;
   size_t numpixels;
-  size_t outsize = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4540,9 +5845,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
@@ -4554,11 +5856,10 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   bytes with 16-bit RGBA, the rest is room for filter bytes.*/
   if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
+  if(restarts) *restarts = 0;
 
-  /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
-  IDAT data is put at the start of the in buffer*/
+  /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk*/
   while(!IEND && !state->error)
   {
     unsigned chunkLength;
@@ -4582,9 +5883,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(!segvector_push_back(idat, data, chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4609,6 +5908,12 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       state->error = readChunk_tRNS(&state->info_png.color, data, chunkLength);
       if(state->error) break;
     }
+    /*restart points of the IDAT data (rsPT), a local extension; it is only valid with the IDAT
+    data it was written with, so it is never kept among the unknown chunks*/
+    else if(lodepng_chunk_type_equals(chunk, "rsPT"))
+    {
+      if(restarts) *restarts = chunk;
+    }
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
     /*background color chunk (bKGD)*/
     else if(lodepng_chunk_type_equals(chunk, "bKGD"))
@@ -4677,36 +5982,107 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
+}
 
-  ucvector_init(&scanlines);
-  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
-  If the decompressed size does not match the prediction, the image must be corrupt.*/
-  if(state->info_png.interlace_method == 0)
+/*size of the decompressed IDAT data, filter bytes included, of a w * h image with the given header*/
+static size_t predictScanlinesSize(unsigned w, unsigned h, const LodePNGInfo* info)
+{
+  size_t predict;
+  if(info->interlace_method == 0)
   {
-    /*The extra *h is added because this are the filter bytes every scanline starts with*/
-    predict = lodepng_get_raw_size_idat(*w, *h, &state->info_png.color) + *h;
+    /*The extra h is added because this are the filter bytes every scanline starts with*/
+    predict = lodepng_get_raw_size_idat(w, h, &info->color) + h;
   }
   else
   {
     /*Adam-7 interlaced: predicted size is the sum of the 7 sub-images sizes*/
-    const LodePNGColorMode* color = &state->info_png.color;
+    const LodePNGColorMode* color = &info->color;
     predict = 0;
-    predict += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    if(*w > 4) predict += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    predict += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, color) + ((*h + 3) >> 3);
-    if(*w > 2) predict += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, color) + ((*h + 3) >> 2);
-    predict += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, color) + ((*h + 1) >> 2);
-    if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
-    predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
-  }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
-  if(!state->error)
+    predict += lodepng_get_raw_size_idat((w + 7) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    if(w > 4) predict += lodepng_get_raw_size_idat((w + 3) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    predict += lodepng_get_raw_size_idat((w + 3) >> 2, (h + 3) >> 3, color) + ((h + 3) >> 3);
+    if(w > 2) predict += lodepng_get_raw_size_idat((w + 1) >> 2, (h + 3) >> 2, color) + ((h + 3) >> 2);
+    predict += lodepng_get_raw_size_idat((w + 1) >> 1, (h + 1) >> 2, color) + ((h + 1) >> 2);
+    if(w > 1) predict += lodepng_get_raw_size_idat((w + 0) >> 1, (h + 1) >> 1, color) + ((h + 1) >> 1);
+    predict += lodepng_get_raw_size_idat((w + 0), (h + 0) >> 1, color) + ((h + 0) >> 1);
+  }
+  return predict;
+}
+
+/*
+Decompresses the zlib stream made up of the segments: into out, which keeps its allocation, or, with
+a sink, handing the data to it in pieces. The built-in decompressor reads the segments in place;
+custom zlib and inflate functions get them copied into one buffer.
+*/
+static unsigned zlib_decompress_segments(ucvector* out, const segvector* in,
+                                         const LodePNGDecompressSettings* settings, const InflateSink* sink)
+{
+  unsigned error;
+  ucvector joined;
+  size_t i, pos = 0;
+
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(!settings->custom_zlib && !settings->custom_inflate)
+  {
+    BitReader reader;
+    BitReader_initSegments(&reader, in->data, in->size, in->insize);
+    return zlib_decompress_reader(out, &reader, settings, sink);
+  }
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+  ucvector_init(&joined);
+  if(!ucvector_resize(&joined, in->insize)) return 83; /*alloc fail*/
+  for(i = 0; i != in->size; ++i)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    if(in->data[i].size) memcpy(joined.data + pos, in->data[i].data, in->data[i].size);
+    pos += in->data[i].size;
   }
-  ucvector_cleanup(&idat);
+  if(sink) error = zlib_decompress_stream(joined.data, joined.size, settings, sink);
+  else error = zlib_decompress_into(out, joined.data, joined.size, settings);
+  ucvector_cleanup(&joined);
+  return error;
+}
+
+/*decompress the IDAT data of a w * h image into scanlines, which must be initialized, setting state->error*/
+static void inflateScanlines(ucvector* scanlines, const segvector* idat, unsigned w, unsigned h, LodePNGState* state)
+{
+  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation:
+  the built-in inflate then writes into it without growing it. If the decompressed size does not
+  match the prediction, the image must be corrupt.*/
+  size_t predict = predictScanlinesSize(w, h, &state->info_png);
+  if(!ucvector_reserve(scanlines, predict)) CERROR_RETURN(state->error, 83); /*alloc fail*/
+  state->error = zlib_decompress_segments(scanlines, idat, &state->decoder.zlibsettings, 0);
+  if(!state->error && scanlines->size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+}
+
+/*read the chunks of a PNG and decompress its IDAT data: the result is the filtered (and possibly
+interlaced) scanlines, each starting with its filter type byte. scanlines must be initialized.*/
+static void decodeScanlines(ucvector* scanlines, unsigned* w, unsigned* h,
+                            LodePNGState* state,
+                            const unsigned char* in, size_t insize)
+{
+  segvector idat; /*the data of the IDAT chunks*/
+
+  segvector_init(&idat);
+  readImageChunks(&idat, 0, w, h, state, in, insize);
+  if(!state->error) inflateScanlines(scanlines, &idat, *w, *h, state);
+  segvector_cleanup(&idat);
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize)
+{
+  ucvector scanlines;
+  size_t i;
+  size_t outsize = 0;
+
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+
+  ucvector_init(&scanlines);
+  decodeScanlines(&scanlines, w, h, state, in, insize);
 
   if(!state->error)
   {
@@ -4767,6 +6143,386 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
   return state->error;
 }
 
+/*hands the rows of a whole image (no padding bits between rows) to the callback one by one*/
+static unsigned emitImageRows(const unsigned char* image, unsigned w, unsigned h, const LodePNGColorMode* mode,
+                              LodePNGRowCallback callback, void* user)
+{
+  unsigned error = 0;
+  unsigned y;
+  size_t bpp = lodepng_get_bpp(mode);
+  size_t linebits = w * bpp;
+  unsigned char* row = 0;
+
+  if(linebits % 8 != 0)
+  {
+    /*rows don't start at byte boundaries, so copy each into a zero-padded row of its own*/
+    row = (unsigned char*)lodepng_malloc((linebits + 7) / 8);
+    if(!row) return 83; /*alloc fail*/
+  }
+
+  for(y = 0; y < h && !error; ++y)
+  {
+    if(row)
+    {
+      size_t ibp = y * linebits, obp = 0, x;
+      for(x = 0; x < (linebits + 7) / 8; ++x) row[x] = 0;
+      for(x = 0; x < linebits; ++x) setBitOfReversedStream0(&obp, row, readBitFromReversedStream(&ibp, image));
+      error = callback(user, y, row, w, h);
+    }
+    else error = callback(user, y, &image[y * (linebits / 8)], w, h);
+  }
+
+  lodepng_free(row);
+  return error;
+}
+
+/*Collects a stream of decompressed IDAT data into scanlines of a non-interlaced image, and unfilters,
+converts and hands out each scanline as soon as it is complete. Only two scanlines are kept: the one
+being filled and the previous one, which is the predictor for unfiltering.*/
+typedef struct RowAssembler
+{
+  LodePNGState* state;
+  unsigned w, h;
+  size_t bytewidth;
+  size_t linebytes; /*bytes per scanline, without the filter type byte*/
+  unsigned char* lines; /*two scanlines of 1 + linebytes bytes, used alternately*/
+  unsigned char* row; /*the converted row, or null if no conversion is needed*/
+  size_t filled; /*bytes of the current scanline received so far*/
+  unsigned y; /*row of the current scanline*/
+  unsigned first, end; /*the rows to assemble: all of them, or one band of an image with restart points*/
+  LodePNGRowCallback callback;
+  void* user;
+} RowAssembler;
+
+/*prepares to assemble all rows of a w * h image whose chunks are read into state; returns error code*/
+static unsigned RowAssembler_init(RowAssembler* rows, LodePNGState* state, unsigned w, unsigned h,
+                                  LodePNGRowCallback callback, void* user)
+{
+  size_t bpp = lodepng_get_bpp(&state->info_png.color);
+  unsigned convert = !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color);
+
+  rows->state = state;
+  rows->w = w;
+  rows->h = h;
+  rows->bytewidth = (bpp + 7) / 8;
+  rows->linebytes = (w * bpp + 7) / 8;
+  rows->lines = (unsigned char*)lodepng_malloc(2 * (1 + rows->linebytes));
+  rows->row = convert ? (unsigned char*)lodepng_malloc(lodepng_get_raw_size(w, 1, &state->info_raw)) : 0;
+  rows->filled = 0;
+  rows->y = 0;
+  rows->first = 0;
+  rows->end = h;
+  rows->callback = callback;
+  rows->user = user;
+
+  return (!rows->lines || (convert && !rows->row)) ? 83 /*alloc fail*/ : 0;
+}
+
+static void RowAssembler_cleanup(RowAssembler* rows)
+{
+  lodepng_free(rows->lines);
+  lodepng_free(rows->row);
+}
+
+static unsigned assembleRows(void* user, const unsigned char* data, size_t size)
+{
+  RowAssembler* rows = (RowAssembler*)user;
+  LodePNGState* state = rows->state;
+  size_t stride = 1 + rows->linebytes;
+
+  while(size > 0)
+  {
+    unsigned char* line = &rows->lines[(rows->y & 1u) * stride];
+    size_t count = stride - rows->filled;
+    unsigned error;
+
+    if(rows->y >= rows->end) return 91; /*more data than the image needs*/
+    if(count > size) count = size;
+    memcpy(&line[rows->filled], data, count);
+    rows->filled += count;
+    data += count;
+    size -= count;
+    if(rows->filled < stride) break;
+
+    /*the first scanline of a band may only use the filters that don't look at the band above*/
+    if(rows->y == rows->first && rows->first != 0 && line[0] > 1) return 95;
+    error = unfilterScanline(&line[1], &line[1],
+                             rows->y != rows->first ? &rows->lines[((rows->y + 1u) & 1u) * stride + 1] : 0,
+                             rows->bytewidth, line[0], rows->linebytes);
+    if(error) return error;
+
+    /*a scanline with its padding bits is exactly a one-row raw image*/
+    if(rows->row)
+    {
+      error = lodepng_convert(rows->row, &line[1], &state->info_raw, &state->info_png.color, rows->w, 1);
+      if(!error) error = rows->callback(rows->user, rows->y, rows->row, rows->w, rows->h);
+    }
+    else error = rows->callback(rows->user, rows->y, &line[1], rows->w, rows->h);
+    if(error) return error;
+
+    rows->filled = 0;
+    ++rows->y;
+  }
+
+  return 0;
+}
+
+/*read the chunks of a PNG for lodepng_decode_rows into idat (see readImageChunks) and state, and check
+that its rows can be converted to state->info_raw. On error state->error is set.*/
+static void readRowChunks(segvector* idat, const unsigned char** restarts, unsigned* w, unsigned* h,
+                          LodePNGState* state, const unsigned char* in, size_t insize)
+{
+  const LodePNGColorMode* mode_in = &state->info_png.color;
+
+  readImageChunks(idat, restarts, w, h, state, in, insize);
+  if(state->error) return;
+
+  if(!state->decoder.color_convert)
+  {
+    state->error = lodepng_color_mode_copy(&state->info_raw, mode_in);
+  }
+  else if(!lodepng_color_mode_equal(&state->info_raw, mode_in))
+  {
+    if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+       && !(state->info_raw.bitdepth == 8))
+    {
+      state->error = 56; /*unsupported color mode conversion*/
+    }
+  }
+}
+
+/*decode the image of lodepng_decode_rows from the IDAT data, once readRowChunks has read the chunks*/
+static void decodeRows(const segvector* idat, unsigned w, unsigned h, LodePNGState* state,
+                       LodePNGRowCallback callback, void* user)
+{
+  const LodePNGColorMode* mode_in = &state->info_png.color;
+  unsigned convert = !lodepng_color_mode_equal(&state->info_raw, mode_in);
+
+  if(state->info_png.interlace_method == 0)
+  {
+    /*Inflate as a stream straight into the row assembler: neither the decompressed data nor the
+    decoded image ever exist in full.*/
+    RowAssembler rows;
+    InflateSink sink;
+
+    sink.write = assembleRows;
+    sink.user = &rows;
+
+    state->error = RowAssembler_init(&rows, state, w, h, callback, user);
+    if(!state->error)
+    {
+      state->error = zlib_decompress_segments(0, idat, &state->decoder.zlibsettings, &sink);
+    }
+    if(!state->error && rows.y != h) state->error = 91; /*decompressed size doesn't match prediction*/
+
+    RowAssembler_cleanup(&rows);
+  }
+  else
+  {
+    /*Adam7: the passes are spread over the whole image, so deinterlace it completely first*/
+    ucvector scanlines;
+    size_t i, outsize = lodepng_get_raw_size(w, h, mode_in);
+    unsigned char* image = 0;
+
+    ucvector_init(&scanlines);
+    inflateScanlines(&scanlines, idat, w, h, state);
+    if(!state->error)
+    {
+      image = (unsigned char*)lodepng_malloc(outsize);
+      if(!image) state->error = 83; /*alloc fail*/
+    }
+    if(!state->error)
+    {
+      for(i = 0; i < outsize; i++) image[i] = 0;
+      state->error = postProcessScanlines(image, scanlines.data, w, h, &state->info_png);
+    }
+    ucvector_cleanup(&scanlines);
+    if(!state->error && convert)
+    {
+      unsigned char* converted = (unsigned char*)lodepng_malloc(lodepng_get_raw_size(w, h, &state->info_raw));
+      if(!converted) state->error = 83; /*alloc fail*/
+      else state->error = lodepng_convert(converted, image, &state->info_raw, mode_in, w, h);
+      lodepng_free(image);
+      image = converted;
+    }
+    if(!state->error)
+    {
+      state->error = emitImageRows(image, w, h, convert ? &state->info_raw : mode_in, callback, user);
+    }
+    lodepng_free(image);
+  }
+}
+
+unsigned lodepng_decode_rows(unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user)
+{
+  segvector idat; /*the data of the IDAT chunks*/
+
+  segvector_init(&idat);
+  readRowChunks(&idat, 0, w, h, state, in, insize);
+  if(!state->error) decodeRows(&idat, *w, *h, state, callback, user);
+  segvector_cleanup(&idat);
+  return state->error;
+}
+
+#if defined(LODEPNG_COMPILE_ZLIB) && defined(LODEPNG_COMPILE_CPP)
+/*
+A PNG with restart points, decoded one band at a time for lodepng::decode_rows_parallel (see restart_rows
+in LodePNGEncoderSettings). Bands only read what BandDecoder_init sets up, so any number of them can be
+decoded at once. (Local addition, not part of upstream LodePNG.)
+*/
+typedef struct BandDecoder
+{
+  LodePNGState* state;
+  segvector idat; /*the data of the IDAT chunks*/
+  const unsigned char* restarts; /*the rsPT chunk*/
+  unsigned w, h;
+  unsigned rows; /*rows per band; the last band may have fewer*/
+  size_t numbands;
+  LodePNGRowCallback callback;
+  void* user;
+} BandDecoder;
+
+/*bit of the zlib stream where a band starts; the first starts right after the header*/
+static size_t BandDecoder_start(const BandDecoder* bands, size_t band)
+{
+  if(band == 0) return 16;
+  return 8 * (size_t)lodepng_read32bitInt(&lodepng_chunk_data_const(bands->restarts)[4 * band]);
+}
+
+/*
+Reads the chunks of a PNG. Returns 1 if its bands can be decoded with BandDecoder_decode; if not,
+or if state->error is set, BandDecoder_decodeSerially decodes it as lodepng_decode_rows would.
+BandDecoder_cleanup must be called either way.
+*/
+static unsigned BandDecoder_init(BandDecoder* bands, LodePNGState* state, const unsigned char* in, size_t insize,
+                                 LodePNGRowCallback callback, void* user)
+{
+  const LodePNGDecompressSettings* zlibsettings = &state->decoder.zlibsettings;
+  const unsigned char* offsets;
+  unsigned char header[2];
+  BitReader reader;
+  size_t band, start = 2; /*byte where the band starts*/
+
+  bands->state = state;
+  bands->w = bands->h = 0;
+  bands->rows = 0;
+  bands->numbands = 0;
+  bands->callback = callback;
+  bands->user = user;
+  segvector_init(&bands->idat);
+
+  readRowChunks(&bands->idat, &bands->restarts, &bands->w, &bands->h, state, in, insize);
+  if(state->error || !bands->restarts) return 0;
+  if(state->info_png.interlace_method != 0 || zlibsettings->custom_zlib || zlibsettings->custom_inflate) return 0;
+
+  offsets = lodepng_chunk_data_const(bands->restarts);
+  if(lodepng_chunk_length(bands->restarts) < 4) return 0;
+  bands->rows = lodepng_read32bitInt(offsets);
+  if(bands->rows == 0 || bands->rows >= bands->h) return 0;
+  bands->numbands = (bands->h - 1) / bands->rows + 1;
+  if(lodepng_chunk_length(bands->restarts) != 4 * bands->numbands) return 0;
+
+  /*every band needs some data, and the stream ends with the Adler-32 after the last one*/
+  for(band = 1; band != bands->numbands; ++band)
+  {
+    size_t next = lodepng_read32bitInt(&offsets[4 * band]);
+    if(next <= start || next >= bands->idat.insize) return 0;
+    start = next;
+  }
+  if(start + 4 >= bands->idat.insize) return 0;
+
+  BitReader_initSegments(&reader, bands->idat.data, bands->idat.size, bands->idat.insize);
+  BitReader_readBytes(&reader, header, 0, 2);
+  return zlib_check_header(header, 2) == 0;
+}
+
+static void BandDecoder_cleanup(BandDecoder* bands)
+{
+  segvector_cleanup(&bands->idat);
+}
+
+/*number of bytes of decompressed data in a band: its scanlines with their filter type bytes*/
+static size_t BandDecoder_size(const BandDecoder* bands, size_t band)
+{
+  unsigned first = (unsigned)band * bands->rows;
+  unsigned count = bands->h - first < bands->rows ? bands->h - first : bands->rows;
+  return lodepng_get_raw_size_idat(bands->w, count, &bands->state->info_png.color) + count;
+}
+
+/*
+Inflates, unfilters and converts one band, handing its rows to the callback, and gives the Adler-32
+of its decompressed data. An error other than the callback's means that the restart points don't
+match the image data (or that it is corrupt), and BandDecoder_decodeSerially must decode it instead.
+*/
+static unsigned BandDecoder_decode(const BandDecoder* bands, size_t band, unsigned* adler)
+{
+  RowAssembler rows;
+  AdlerSink adler_sink;
+  InflateSink sink, checked;
+  ucvector window;
+  BitReader reader;
+  size_t end = band + 1 == bands->numbands ? 0 : BandDecoder_start(bands, band + 1);
+  unsigned error;
+
+  sink.write = assembleRows;
+  sink.user = &rows;
+  adler_sink.next = &sink;
+  adler_sink.adler = 1;
+  checked.write = adlerSinkWrite;
+  checked.user = &adler_sink;
+
+  ucvector_init(&window);
+  error = RowAssembler_init(&rows, bands->state, bands->w, bands->h, bands->callback, bands->user);
+  if(!error)
+  {
+    rows.first = rows.y = (unsigned)band * bands->rows;
+    rows.end = bands->h - rows.first < bands->rows ? bands->h : rows.first + bands->rows;
+    if(!ucvector_reserve(&window, INFLATE_FLUSH_SIZE)) error = 83; /*alloc fail*/
+  }
+  if(!error)
+  {
+    BitReader_initSegments(&reader, bands->idat.data, bands->idat.size, bands->idat.insize);
+    BitReader_seek(&reader, BandDecoder_start(bands, band));
+    error = inflateBlocks(&window, &reader, &checked, end);
+  }
+  if(!error && rows.y != rows.end) error = 91; /*decompressed size doesn't match prediction*/
+  *adler = adler_sink.adler;
+
+  ucvector_cleanup(&window);
+  RowAssembler_cleanup(&rows);
+  return error;
+}
+
+/*checks the Adler-32 at the end of the stream against the Adler-32s of the bands' data, in order*/
+static unsigned BandDecoder_checkAdler(const BandDecoder* bands, const unsigned* adlers)
+{
+  unsigned char checksum[4];
+  unsigned adler = adlers[0];
+  BitReader reader;
+  size_t band;
+
+  if(bands->state->decoder.zlibsettings.ignore_adler32) return 0;
+  for(band = 1; band != bands->numbands; ++band)
+  {
+    adler = adler32_combine(adler, adlers[band], BandDecoder_size(bands, band));
+  }
+  BitReader_initSegments(&reader, bands->idat.data, bands->idat.size, bands->idat.insize);
+  BitReader_readBytes(&reader, checksum, bands->idat.insize - 4, 4);
+  return adler == lodepng_read32bitInt(checksum) ? 0 : 58; /*error, adler checksum not correct*/
+}
+
+/*decodes the whole PNG as lodepng_decode_rows does, unless reading its chunks failed; sets state->error*/
+static void BandDecoder_decodeSerially(BandDecoder* bands)
+{
+  if(!bands->state->error)
+  {
+    decodeRows(&bands->idat, bands->w, bands->h, bands->state, bands->callback, bands->user);
+  }
+}
+#endif /*LODEPNG_COMPILE_ZLIB && LODEPNG_COMPILE_CPP*/
+
 unsigned lodepng_decode_memory(unsigned char** out, unsigned* w, unsigned* h, const unsigned char* in,
                                size_t insize, LodePNGColorType colortype, unsigned bitdepth)
 {
@@ -4985,6 +6741,59 @@ static unsigned addChunk_IDAT(ucvector* out, const unsigned char* data, size_t d
   return error;
 }
 
+/*
+Rows per band of an image of h rows whose IDAT data has restart points, or 0 if it is compressed as one
+stream. That needs the built-in compressor, and Adam7 passes don't keep rows together.
+(Local addition, not part of upstream LodePNG.)
+*/
+static unsigned restartRows(const LodePNGInfo* info_png, unsigned h, const LodePNGEncoderSettings* settings)
+{
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(info_png->interlace_method != 0) return 0;
+  if(settings->zlibsettings.custom_zlib || settings->zlibsettings.custom_deflate) return 0;
+  return settings->restart_rows < h ? settings->restart_rows : 0;
+#else /*no LODEPNG_COMPILE_ZLIB*/
+  (void)info_png; (void)h; (void)settings;
+  return 0;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+}
+
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Adds the IDAT chunk of a w * h image whose scanlines are compressed in bands of restartRows scanlines,
+preceded by an rsPT chunk with their restart points (see restart_rows in LodePNGEncoderSettings).
+(Local addition, not part of upstream LodePNG.)
+*/
+static unsigned addChunks_rsPT_IDAT(ucvector* out, const unsigned char* data, size_t datasize,
+                                    unsigned w, unsigned h, const LodePNGInfo* info,
+                                    const LodePNGEncoderSettings* settings)
+{
+  ucvector zlibdata, rsPT;
+  uivector offsets;
+  unsigned error = 0;
+  unsigned rows = restartRows(info, h, settings);
+  size_t stride = 1 + (w * (size_t)lodepng_get_bpp(&info->color) + 7) / 8; /*a scanline and its filter type*/
+  size_t i;
+
+  ucvector_init(&zlibdata);
+  ucvector_init(&rsPT);
+  uivector_init(&offsets);
+  error = zlib_compress_bands(&zlibdata, &offsets, data, datasize, rows * stride, &settings->zlibsettings);
+  if(!error)
+  {
+    lodepng_add32bitInt(&rsPT, rows);
+    for(i = 0; i != offsets.size; ++i) lodepng_add32bitInt(&rsPT, offsets.data[i]);
+    error = addChunk(out, "rsPT", rsPT.data, rsPT.size);
+  }
+  if(!error) error = addChunk(out, "IDAT", zlibdata.data, zlibdata.size);
+  uivector_cleanup(&offsets);
+  ucvector_cleanup(&rsPT);
+  ucvector_cleanup(&zlibdata);
+
+  return error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
 static unsigned addChunk_IEND(ucvector* out)
 {
   unsigned error = 0;
@@ -5199,6 +7008,57 @@ static void filterScanline(unsigned char* out, const unsigned char* scanline, co
   }
 }
 
+/*
+Filters one scanline with each of the 5 filter types and keeps the one with the minimum sum
+of absolute values, as LFS_MINSUM does for every scanline. out receives the filter type byte
+followed by the filtered scanline; attempt must hold 5 buffers of linebytes bytes.
+(Local addition, not part of upstream LodePNG: factored out of filter() so that predefined
+filter lists can leave single scanlines to the heuristic.)
+*/
+static void filterScanlineMinsum(unsigned char* out, const unsigned char* scanline, const unsigned char* prevline,
+                                 size_t linebytes, size_t bytewidth, unsigned char* attempt[5])
+{
+  size_t sum[5];
+  size_t smallest = 0;
+  unsigned char type, bestType = 0;
+  size_t x;
+
+  /*try the 5 filter types*/
+  for(type = 0; type != 5; ++type)
+  {
+    filterScanline(attempt[type], scanline, prevline, linebytes, bytewidth, type);
+
+    /*calculate the sum of the result*/
+    sum[type] = 0;
+    if(type == 0)
+    {
+      for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
+    }
+    else
+    {
+      for(x = 0; x != linebytes; ++x)
+      {
+        /*For differences, each byte should be treated as signed, values above 127 are negative
+        (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
+        This means filtertype 0 is almost never chosen, but that is justified.*/
+        unsigned char s = attempt[type][x];
+        sum[type] += s < 128 ? s : (255U - s);
+      }
+    }
+
+    /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
+    if(type == 0 || sum[type] < smallest)
+    {
+      bestType = type;
+      smallest = sum[type];
+    }
+  }
+
+  /*now fill the out values*/
+  out[0] = bestType; /*the first byte of a scanline will be the filter type*/
+  for(x = 0; x != linebytes; ++x) out[1 + x] = attempt[bestType][x];
+}
+
 /* log2 approximation. A slight bit faster than std::log. */
 static float flog2(float f)
 {
@@ -5208,8 +7068,28 @@ static float flog2(float f)
   return result + 1.442695f * (f * f * f / 3 - 3 * f * f / 2 + 3 * f - 1.83333f);
 }
 
+/*
+Refilters the first scanline of every band of restart_rows scanlines after the first with Sub if its
+filter predicts from the scanline above, which belongs to another band. None and Sub reconstruct the
+same whether or not the scanline above is known, so each band can be unfiltered on its own, and by
+any decoder. (Local addition, not part of upstream LodePNG.)
+*/
+static void unlinkBands(unsigned char* out, const unsigned char* in, unsigned h, size_t linebytes,
+                        size_t bytewidth, unsigned restart_rows)
+{
+  unsigned y;
+  for(y = restart_rows; y < h; y += restart_rows)
+  {
+    unsigned char* line = &out[(1 + linebytes) * y];
+    if(line[0] <= 1) continue;
+    line[0] = 1;
+    filterScanline(&line[1], &in[linebytes * y], 0, linebytes, bytewidth, 1);
+  }
+}
+
 static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
-                       const LodePNGColorMode* info, const LodePNGEncoderSettings* settings)
+                       const LodePNGColorMode* info, const LodePNGEncoderSettings* settings,
+                       unsigned restart_rows)
 {
   /*
   For PNG filter method 0
@@ -5259,10 +7139,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   else if(strategy == LFS_MINSUM)
   {
     /*adaptive filtering*/
-    size_t sum[5];
     unsigned char* attempt[5]; /*five filtering attempts, one for each filter type*/
-    size_t smallest = 0;
-    unsigned char type, bestType = 0;
+    unsigned char type;
 
     for(type = 0; type != 5; ++type)
     {
@@ -5274,42 +7152,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
     {
       for(y = 0; y != h; ++y)
       {
-        /*try the 5 filter types*/
-        for(type = 0; type != 5; ++type)
-        {
-          filterScanline(attempt[type], &in[y * linebytes], prevline, linebytes, bytewidth, type);
-
-          /*calculate the sum of the result*/
-          sum[type] = 0;
-          if(type == 0)
-          {
-            for(x = 0; x != linebytes; ++x) sum[type] += (unsigned char)(attempt[type][x]);
-          }
-          else
-          {
-            for(x = 0; x != linebytes; ++x)
-            {
-              /*For differences, each byte should be treated as signed, values above 127 are negative
-              (converted to signed char). Filtertype 0 isn't a difference though, so use unsigned there.
-              This means filtertype 0 is almost never chosen, but that is justified.*/
-              unsigned char s = attempt[type][x];
-              sum[type] += s < 128 ? s : (255U - s);
-            }
-          }
-
-          /*check if this is smallest sum (or if type == 0 it's the first case so always store the values)*/
-          if(type == 0 || sum[type] < smallest)
-          {
-            bestType = type;
-            smallest = sum[type];
-          }
-        }
-
+        filterScanlineMinsum(&out[y * (linebytes + 1)], &in[y * linebytes], prevline, linebytes, bytewidth, attempt);
         prevline = &in[y * linebytes];
-
-        /*now fill the out values*/
-        out[y * (linebytes + 1)] = bestType; /*the first byte of a scanline will be the filter type*/
-        for(x = 0; x != linebytes; ++x) out[y * (linebytes + 1) + 1 + x] = attempt[bestType][x];
       }
     }
 
@@ -5363,15 +7207,33 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   }
   else if(strategy == LFS_PREDEFINED)
   {
-    for(y = 0; y != h; ++y)
+    /*buffers for the rows marked LODEPNG_FILTER_MINSUM, allocated when the first one is met*/
+    unsigned char* attempt[5] = {0, 0, 0, 0, 0};
+    unsigned char type;
+
+    for(y = 0; y != h && !error; ++y)
     {
       size_t outindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
       size_t inindex = linebytes * y;
-      unsigned char type = settings->predefined_filters[y];
-      out[outindex] = type; /*filter type byte*/
-      filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, type);
+      type = settings->predefined_filters[y];
+      if(type == LODEPNG_FILTER_MINSUM)
+      {
+        for(type = 0; type != 5 && !error; ++type)
+        {
+          if(!attempt[type]) attempt[type] = (unsigned char*)lodepng_malloc(linebytes);
+          if(!attempt[type]) error = 83; /*alloc fail*/
+        }
+        if(!error) filterScanlineMinsum(&out[outindex], &in[inindex], prevline, linebytes, bytewidth, attempt);
+      }
+      else
+      {
+        out[outindex] = type; /*filter type byte*/
+        filterScanline(&out[outindex + 1], &in[inindex], prevline, linebytes, bytewidth, type);
+      }
       prevline = &in[inindex];
     }
+
+    for(type = 0; type != 5; ++type) lodepng_free(attempt[type]);
   }
   else if(strategy == LFS_BRUTE_FORCE)
   {
@@ -5425,6 +7287,8 @@ static unsigned filter(unsigned char* out, const unsigned char* in, unsigned w,
   }
   else return 88; /* unknown filter strategy */
 
+  if(!error && restart_rows) unlinkBands(out, in, h, linebytes, bytewidth, restart_rows);
+
   return error;
 }
 
@@ -5522,6 +7386,7 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
   *) if adam7: 1) Adam7_interlace 2) 7x add padding bits 3) 7x filter
   */
   unsigned bpp = lodepng_get_bpp(&info_png->color);
+  unsigned restart_rows = restartRows(info_png, h, settings);
   unsigned error = 0;
 
   if(info_png->interlace_method == 0)
@@ -5540,14 +7405,14 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
         if(!error)
         {
           addPaddingBits(padded, in, ((w * bpp + 7) / 8) * 8, w * bpp, h);
-          error = filter(*out, padded, w, h, &info_png->color, settings);
+          error = filter(*out, padded, w, h, &info_png->color, settings, restart_rows);
         }
         lodepng_free(padded);
       }
       else
       {
         /*we can immediately filter into the out buffer, no other steps needed*/
-        error = filter(*out, in, w, h, &info_png->color, settings);
+        error = filter(*out, in, w, h, &info_png->color, settings, restart_rows);
       }
     }
   }
@@ -5580,13 +7445,13 @@ static unsigned preProcessScanlines(unsigned char** out, size_t* outsize, const
           addPaddingBits(padded, &adam7[passstart[i]],
                          ((passw[i] * bpp + 7) / 8) * 8, passw[i] * bpp, passh[i]);
           error = filter(&(*out)[filter_passstart[i]], padded,
-                         passw[i], passh[i], &info_png->color, settings);
+                         passw[i], passh[i], &info_png->color, settings, 0);
           lodepng_free(padded);
         }
         else
         {
           error = filter(&(*out)[filter_passstart[i]], &adam7[padded_passstart[i]],
-                         passw[i], passh[i], &info_png->color, settings);
+                         passw[i], passh[i], &info_png->color, settings, 0);
         }
 
         if(error) break;
@@ -5749,6 +7614,13 @@ unsigned lodepng_encode(unsigned char** out, size_t* outsize,
     }
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
     /*IDAT (multiple IDAT chunks must be consecutive)*/
+#ifdef LODEPNG_COMPILE_ZLIB
+    if(restartRows(&info, h, &state->encoder))
+    {
+      state->error = addChunks_rsPT_IDAT(&outv, data, datasize, w, h, &info, &state->encoder);
+    }
+    else
+#endif /*LODEPNG_COMPILE_ZLIB*/
     state->error = addChunk_IDAT(&outv, data, datasize, &state->encoder.zlibsettings);
     if(state->error) break;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
@@ -5889,6 +7761,7 @@ void lodepng_encoder_settings_init(LodePNGEncoderSettings* settings)
   settings->auto_convert = 1;
   settings->force_palette = 0;
   settings->predefined_filters = 0;
+  settings->restart_rows = 0;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->add_id = 0;
   settings->text_compression = 1;
@@ -6000,6 +7873,8 @@ const char* lodepng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    /*restart points of the rsPT chunk don't match the IDAT data (Local addition)*/
+    case 95: return "a band of the image data doesn't end at the next restart point";
   }
   return "unknown error code";
 }
@@ -6149,6 +8024,72 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
   return decode(out, w, h, state, in.empty() ? 0 : &in[0], in.size());
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+namespace
+{
+/*passes decode_rows_parallel's rows on to the caller's callback, keeping the first error it returns*/
+struct ParallelRows
+{
+  LodePNGRowCallback callback;
+  void* user;
+  std::atomic<unsigned> error;
+};
+
+unsigned forwardRow(void* user, unsigned y, const unsigned char* row, unsigned w, unsigned h)
+{
+  ParallelRows* rows = (ParallelRows*)user;
+  unsigned error = rows->callback(rows->user, y, row, w, h);
+  unsigned none = 0;
+  if(error) rows->error.compare_exchange_strong(none, error);
+  return error;
+}
+} /* namespace */
+#endif /* LODEPNG_COMPILE_ZLIB */
+
+unsigned decode_rows_parallel(unsigned& w, unsigned& h, State& state,
+                              const unsigned char* in, size_t insize,
+                              LodePNGRowCallback callback, void* user, unsigned threads)
+{
+#ifdef LODEPNG_COMPILE_ZLIB
+  ParallelRows rows;
+  BandDecoder bands;
+  rows.callback = callback;
+  rows.user = user;
+  rows.error = 0;
+
+  if(BandDecoder_init(&bands, &state, in, insize, forwardRow, &rows))
+  {
+    /*The bands are independent, so each worker takes the next band not yet started until none are
+    left. The calling thread works too.*/
+    std::vector<unsigned> adlers(bands.numbands);
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+    auto work = [&]()
+    {
+      for(size_t band = next++; band < bands.numbands && !failed; band = next++)
+      {
+        if(BandDecoder_decode(&bands, band, &adlers[band])) failed = true;
+      }
+    };
+
+    if(threads == 0) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    lodepng_run_threads(std::min<size_t>(threads, bands.numbands), work);
+
+    if(rows.error) state.error = rows.error;
+    else if(failed || BandDecoder_checkAdler(&bands, adlers.data())) BandDecoder_decodeSerially(&bands);
+  }
+  else BandDecoder_decodeSerially(&bands);
+
+  w = bands.w;
+  h = bands.h;
+  BandDecoder_cleanup(&bands);
+  return state.error;
+#else /* no LODEPNG_COMPILE_ZLIB */
+  (void)threads;
+  return lodepng_decode_rows(&w, &h, &state, in, insize, callback, user);
+#endif /* LODEPNG_COMPILE_ZLIB */
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
@@ -290,6 +290,13 @@ struct LodePNGCompressSettings /*deflate = compress*/
   unsigned minmatch; /*mininum lz77 length. 3 is normally best, 6 can be better for some PNGs. Default: 0*/
   unsigned nicematch; /*stop searching if >= this length found. Set to 258 for best compression. Default: 128*/
   unsigned lazymatching; /*use lazy matching: better compression but a bit slower. Default: true*/
+  /*If not 1, data of more than 256KB is cut into chunks of whole deflate blocks that are compressed
+  independently on this many threads (0: one per CPU core) and concatenated, as pigz does. Each chunk
+  still matches the window of data before it, and all but the last end with a full flush. The chunks
+  don't depend on the number of threads, so neither does the output. Threads are only used when
+  compiled as C++ (LODEPNG_COMPILE_CPP); otherwise the chunks are compressed one after the other.
+  Default: 1. (Local addition, not part of upstream LodePNG.)*/
+  unsigned threads;
 
   /*use custom zlib encoder instead of built in one (default: null)*/
   unsigned (*custom_zlib)(unsigned char**, size_t*,
@@ -554,6 +561,10 @@ typedef enum LodePNGFilterStrategy
   LFS_PREDEFINED
 } LodePNGFilterStrategy;
 
+/*predefined_filters value that leaves the scanline to the LFS_MINSUM heuristic
+(Local addition, not part of upstream LodePNG.)*/
+#define LODEPNG_FILTER_MINSUM 255
+
 /*Gives characteristics about the colors of the image, which helps decide which color model to use for encoding.
 Used internally by default if "auto_convert" is enabled. Public because it's useful for custom algorithms.*/
 typedef struct LodePNGColorProfile
@@ -599,9 +610,23 @@ typedef struct LodePNGEncoderSettings
   /*used if filter_strategy is LFS_PREDEFINED. In that case, this must point to a buffer with
   the same length as the amount of scanlines in the image, and each value must <= 5. You
   have to cleanup this buffer, LodePNG will never free it. Don't forget that filter_palette_zero
-  must be set to 0 to ensure this is also used on palette or low bitdepth images.*/
+  must be set to 0 to ensure this is also used on palette or low bitdepth images.
+  A value of LODEPNG_FILTER_MINSUM instead chooses that scanline's filter as LFS_MINSUM would,
+  for callers that know the best filter for some scanlines but not others.
+  (LODEPNG_FILTER_MINSUM is a local addition, not part of upstream LodePNG.)*/
   const unsigned char* predefined_filters;
 
+  /*If not 0, the scanlines of a non-interlaced image are compressed in bands of this many rows
+  that can be decompressed and unfiltered independently, e.g. on several threads by
+  lodepng::decode_rows_parallel. Each band is deflated on its own and ends with a full flush, and
+  the first scanline of each band after the first is filtered with None or Sub, so it doesn't
+  depend on the band above. The file stays a standard PNG; an rsPT chunk before IDAT records
+  the restart points: the rows per band as a 4-byte integer, followed by one 4-byte position in
+  the zlib stream for each band after the first. Ignored for Adam7, for images of at most
+  restart_rows rows and with a custom zlib or deflate function. Default: 0.
+  (Local addition, not part of upstream LodePNG.)*/
+  unsigned restart_rows;
+
   /*force creating a PLTE chunk if colortype is 2 or 6 (= a suggested palette).
   If colortype is 3, PLTE is _always_ created.*/
   unsigned force_palette;
@@ -659,6 +684,28 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Called by lodepng_decode_rows once per image row, top to bottom. row holds the w pixels
+of row y in the color type of state->info_raw and is only valid during the call. A
+nonzero return value stops decoding and is returned by lodepng_decode_rows as the error.
+*/
+typedef unsigned (*LodePNGRowCallback)(void* user, unsigned y, const unsigned char* row,
+                                       unsigned w, unsigned h);
+
+/*
+Same as lodepng_decode, but instead of allocating a buffer for the whole image, hands
+every row to callback as soon as it is reconstructed. For non-interlaced images the IDAT
+stream is inflated in pieces and each scanline is unfiltered and converted to info_raw
+on its own as soon as it is complete, so besides the concatenated compressed data only
+a 32KB inflate window and two scanlines are held; the caller can convert rows straight
+into its own storage. Adam7 images are still deinterlaced whole first, and with a custom
+zlib or inflate function the decompressed data is produced in full before it is split
+into rows. (Local addition, not part of upstream LodePNG.)
+*/
+unsigned lodepng_decode_rows(unsigned* w, unsigned* h, LodePNGState* state,
+                             const unsigned char* in, size_t insize,
+                             LodePNGRowCallback callback, void* user);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
@@ -834,6 +881,20 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const std::vector<unsigned char>& in);
+
+/*
+Same as lodepng_decode_rows, but a PNG with restart points (see restart_rows in
+LodePNGEncoderSettings) is decoded one band per thread, on up to threads threads
+(0: one per hardware thread), each band inflated, unfiltered and converted on its own.
+The callback is then called from several threads at once, for different rows and in no
+particular order, so it must be safe to call that way. Other PNGs, and PNGs whose restart
+points don't match their image data, are decoded by lodepng_decode_rows on the calling
+thread; in the latter case rows already handed over are handed over again.
+(Local addition, not part of upstream LodePNG.)
+*/
+unsigned decode_rows_parallel(unsigned& w, unsigned& h, State& state,
+                              const unsigned char* in, size_t insize,
+                              LodePNGRowCallback callback, void* user, unsigned threads = 0);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER